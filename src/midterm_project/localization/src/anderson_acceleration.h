@@ -0,0 +1,74 @@
+#ifndef ANDERSON_ACCELERATION_H
+#define ANDERSON_ACCELERATION_H
+
+#include <deque>
+
+#include <Eigen/QR>
+
+#include "se3_utils.h"
+
+/**
+ * @brief Anderson acceleration of a fixed point iteration x <- G(x) on the 6 twist parameters.
+ *
+ * Keeps the last depth differences of G(x) and of the residual f = G(x) - x and
+ * extrapolates with the combination that minimizes the residual in the least
+ * squares sense. The caller is responsible for the safeguard: if an
+ * accelerated iterate is worse than its predecessor, take the plain G(x)
+ * instead and reset().
+ */
+class AndersonAcceleration
+{
+    int depth;
+    bool hasPrevious;
+    Vector6d previousG, previousF;
+    std::deque<Vector6d, Eigen::aligned_allocator<Vector6d>> deltaG, deltaF;
+
+public:
+    explicit AndersonAcceleration(int history = 5) : depth(history), hasPrevious(false) {}
+
+    void reset()
+    {
+        hasPrevious = false;
+        deltaG.clear();
+        deltaF.clear();
+    }
+
+    /**
+     * @brief next iterate
+     *
+     * @param x current iterate
+     * @param g G(x), result of one plain iteration from x
+     * @return accelerated iterate, g itself while there is no history
+     */
+    Vector6d compute(const Vector6d &x, const Vector6d &g)
+    {
+        Vector6d f = g - x;
+        if (hasPrevious)
+        {
+            deltaG.push_back(g - previousG);
+            deltaF.push_back(f - previousF);
+            if ((int)deltaG.size() > depth)
+            {
+                deltaG.pop_front();
+                deltaF.pop_front();
+            }
+        }
+        previousG = g;
+        previousF = f;
+        hasPrevious = true;
+
+        if (deltaF.empty())
+            return g;
+
+        Eigen::MatrixXd F(6, deltaF.size()), G(6, deltaG.size());
+        for (size_t i = 0; i < deltaF.size(); i++)
+        {
+            F.col(i) = deltaF[i];
+            G.col(i) = deltaG[i];
+        }
+        Eigen::VectorXd theta = F.colPivHouseholderQr().solve(f);
+        return g - G * theta;
+    }
+};
+
+#endif // ANDERSON_ACCELERATION_H
@@ -0,0 +1,130 @@
+#ifndef DESKEW_H
+#define DESKEW_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+/**
+ * @brief Motion distortion compensation of one lidar sweep.
+ *
+ * Every point gets its time in the sweep as a fraction s in [0, 1]: from the
+ * per point timestamps when the driver provides them, otherwise from the
+ * azimuth travelled since the first return. The sensor motion is sampled at
+ * bins + 1 knots over the sweep (knot k at s = k / bins, pose of the sensor at
+ * that time in the reference frame) and a point is moved with the knot of its
+ * bin. Points are grouped per bin with a counting sort, so each bin is one
+ * 3 x n matrix product over the point array instead of a pose interpolation
+ * per point.
+ */
+class ScanDeskew
+{
+    std::vector<int> binStart;
+    std::vector<int> order;
+
+public:
+    int bins = 64;
+    // the sensor spins clockwise seen from above, the azimuth decreases with time
+    bool clockwise = true;
+
+    /**
+     * @brief sweep fraction of every point from its azimuth, relative to the first return
+     *
+     */
+    template <typename PointT>
+    void azimuthTimes(const pcl::PointCloud<PointT> &scan, std::vector<float> &s) const
+    {
+        s.resize(scan.size());
+        float start = 0;
+        bool has_start = false;
+        const float two_pi = float(2 * M_PI);
+        for (size_t i = 0; i < scan.size(); i++)
+        {
+            const PointT &p = scan.points[i];
+            float azimuth = std::atan2(p.y, p.x);
+            if (!std::isfinite(azimuth))
+            {
+                s[i] = 0;
+                continue;
+            }
+            if (!has_start)
+            {
+                start = azimuth;
+                has_start = true;
+            }
+            float travelled = clockwise ? start - azimuth : azimuth - start;
+            travelled = std::fmod(travelled + 2 * two_pi, two_pi);
+            s[i] = travelled / two_pi;
+        }
+    }
+
+    /**
+     * @brief sweep fraction from per point times, the latest point ends the sweep
+     *
+     * @param times time of every point, any offset
+     * @param period duration of a sweep
+     */
+    void relativeTimes(const std::vector<float> &times, double period, std::vector<float> &s) const
+    {
+        s.resize(times.size());
+        if (times.empty())
+            return;
+        float end = *std::max_element(times.begin(), times.end());
+        for (size_t i = 0; i < times.size(); i++)
+            s[i] = std::min(1.0f, std::max(0.0f, float(1.0 - (end - times[i]) / period)));
+    }
+
+    /**
+     * @brief move every point into the reference frame
+     *
+     * @param scan points, reordered by bin
+     * @param s sweep fraction of every point
+     * @param knots bins + 1 poses, reference <- sensor at s = k / bins
+     */
+    template <typename PointT>
+    void apply(pcl::PointCloud<PointT> &scan, const std::vector<float> &s, const std::vector<Eigen::Isometry3f> &knots)
+    {
+        const int n = scan.size();
+        if (n == 0)
+            return;
+        binStart.assign(bins + 2, 0);
+        for (int i = 0; i < n; i++)
+            binStart[bin(s[i]) + 1]++;
+        for (int b = 0; b <= bins; b++)
+            binStart[b + 1] += binStart[b];
+
+        order.resize(n);
+        std::vector<int> fill(binStart.begin(), binStart.end() - 1);
+        for (int i = 0; i < n; i++)
+            order[fill[bin(s[i])]++] = i;
+        pcl::PointCloud<PointT> sorted;
+        sorted.resize(n);
+        for (int k = 0; k < n; k++)
+            sorted.points[k] = scan.points[order[k]];
+        sorted.header = scan.header;
+        scan.swap(sorted);
+
+        // x, y, z of the point array in place, 3 x n with the point size as stride
+        auto xyz = scan.getMatrixXfMap(3, sizeof(PointT) / sizeof(float), 0);
+        for (int b = 0; b <= bins; b++)
+        {
+            int count = binStart[b + 1] - binStart[b];
+            if (count == 0)
+                continue;
+            const Eigen::Isometry3f &T = knots[b];
+            auto block = xyz.middleCols(binStart[b], count);
+            block = (T.linear() * block).colwise() + T.translation();
+        }
+    }
+
+private:
+    int bin(float s) const
+    {
+        return std::min(bins, std::max(0, int(std::round(s * bins))));
+    }
+};
+
+#endif // DESKEW_H
@@ -0,0 +1,243 @@
+#ifndef ERROR_STATE_KF_H
+#define ERROR_STATE_KF_H
+
+#include "se3_utils.h"
+
+/**
+ * @brief Error-state Kalman filter for the car pose.
+ *
+ * Nominal state: position p and velocity v in the map frame, orientation q
+ * (map <- car), accelerometer bias ba and gyroscope bias bg. The filter runs
+ * on the 15 dimensional error [dp, dv, dtheta, dba, dbg], with dtheta applied on
+ * the right (q_true = q * exp(dtheta)).
+ *
+ * Prediction either integrates IMU samples or applies the relative motion of
+ * wheel odometry; wheel velocity and ICP poses are fused as corrections.
+ */
+class ErrorStateKF
+{
+public:
+    typedef Eigen::Matrix<double, 15, 1> ErrorVector;
+    typedef Eigen::Matrix<double, 15, 15> ErrorMatrix;
+
+    enum
+    {
+        P = 0,
+        V = 3,
+        TH = 6,
+        BA = 9,
+        BG = 12
+    };
+
+    struct Noise
+    {
+        double acc = 0.5;        // accelerometer white noise, m/s^2
+        double gyro = 0.05;      // gyroscope white noise, rad/s
+        double acc_bias = 0.01;  // accelerometer bias random walk
+        double gyro_bias = 0.001; // gyroscope bias random walk
+        double odom_trans = 0.05; // odometry translation noise per metre
+        double odom_rot = 0.01;   // odometry rotation noise per radian
+    };
+
+    ErrorStateKF() : gravity(0, 0, -9.81)
+    {
+        reset(Eigen::Isometry3d::Identity());
+        initialized = false;
+    }
+
+    void setNoise(const Noise &n) { noise = n; }
+    bool isInitialized() const { return initialized; }
+
+    /**
+     * @brief (re)initialize the nominal state at a pose, velocity and biases zero
+     *
+     */
+    void reset(const Eigen::Isometry3d &pose, double position_var = 1.0, double rotation_var = 0.1)
+    {
+        p = pose.translation();
+        q = Eigen::Quaterniond(pose.linear()).normalized();
+        v.setZero();
+        ba.setZero();
+        bg.setZero();
+        cov.setZero();
+        cov.block<3, 3>(P, P).diagonal().setConstant(position_var);
+        cov.block<3, 3>(V, V).diagonal().setConstant(1.0);
+        cov.block<3, 3>(TH, TH).diagonal().setConstant(rotation_var);
+        cov.block<3, 3>(BA, BA).diagonal().setConstant(0.01);
+        cov.block<3, 3>(BG, BG).diagonal().setConstant(1e-4);
+        initialized = true;
+    }
+
+    /**
+     * @brief propagate with one IMU sample (car frame)
+     *
+     * @param acc measured specific force
+     * @param gyro measured angular velocity
+     * @param dt time since the previous sample
+     */
+    void predictImu(const Eigen::Vector3d &acc, const Eigen::Vector3d &gyro, double dt)
+    {
+        if (!initialized || dt <= 0)
+            return;
+
+        Eigen::Matrix3d R = q.toRotationMatrix();
+        Eigen::Vector3d a = acc - ba;
+        Eigen::Vector3d w = gyro - bg;
+
+        // nominal state
+        Eigen::Vector3d acc_world = R * a + gravity;
+        p += v * dt + 0.5 * acc_world * dt * dt;
+        v += acc_world * dt;
+        q = (q * Eigen::Quaterniond(expSO3(w * dt))).normalized();
+
+        // error state
+        ErrorMatrix F = ErrorMatrix::Identity();
+        F.block<3, 3>(P, V) = Eigen::Matrix3d::Identity() * dt;
+        F.block<3, 3>(V, TH) = -R * skew(a) * dt;
+        F.block<3, 3>(V, BA) = -R * dt;
+        F.block<3, 3>(TH, TH) = expSO3(w * dt).transpose();
+        F.block<3, 3>(TH, BG) = -Eigen::Matrix3d::Identity() * dt;
+
+        ErrorMatrix Q = ErrorMatrix::Zero();
+        Q.block<3, 3>(V, V).diagonal().setConstant(noise.acc * noise.acc * dt * dt);
+        Q.block<3, 3>(TH, TH).diagonal().setConstant(noise.gyro * noise.gyro * dt * dt);
+        Q.block<3, 3>(BA, BA).diagonal().setConstant(noise.acc_bias * noise.acc_bias * dt);
+        Q.block<3, 3>(BG, BG).diagonal().setConstant(noise.gyro_bias * noise.gyro_bias * dt);
+
+        cov = F * cov * F.transpose() + Q;
+    }
+
+    /**
+     * @brief propagate with the relative motion measured by wheel odometry (car frame)
+     *
+     * @param delta motion of the car since the previous odometry message
+     * @param dt time since the previous odometry message
+     */
+    void predictRelative(const Eigen::Isometry3d &delta, double dt)
+    {
+        if (!initialized || dt <= 0)
+            return;
+
+        Eigen::Matrix3d R = q.toRotationMatrix();
+        Eigen::Vector3d dp = delta.translation();
+
+        p += R * dp;
+        v = R * dp / dt;
+        q = (q * Eigen::Quaterniond(delta.linear())).normalized();
+
+        ErrorMatrix F = ErrorMatrix::Identity();
+        F.block<3, 3>(P, TH) = -R * skew(dp);
+        F.block<3, 3>(TH, TH) = delta.linear().transpose();
+
+        double trans_std = noise.odom_trans * dp.norm() + 1e-3;
+        double rot_std = noise.odom_rot * Eigen::AngleAxisd(delta.linear()).angle() + 1e-4;
+        ErrorMatrix Q = ErrorMatrix::Zero();
+        Q.block<3, 3>(P, P).diagonal().setConstant(trans_std * trans_std);
+        Q.block<3, 3>(V, V).diagonal().setConstant(trans_std * trans_std / (dt * dt));
+        Q.block<3, 3>(TH, TH).diagonal().setConstant(rot_std * rot_std);
+
+        cov = F * cov * F.transpose() + Q;
+    }
+
+    /**
+     * @brief correct with a velocity measured in the car frame (wheel odometry)
+     *
+     */
+    void updateVelocity(const Eigen::Vector3d &velocity, const Eigen::Matrix3d &noise_cov)
+    {
+        if (!initialized)
+            return;
+
+        Eigen::Matrix3d Rt = q.toRotationMatrix().transpose();
+        Eigen::Vector3d predicted = Rt * v;
+
+        Eigen::Matrix<double, 3, 15> H = Eigen::Matrix<double, 3, 15>::Zero();
+        H.block<3, 3>(0, V) = Rt;
+        H.block<3, 3>(0, TH) = skew(predicted);
+
+        correct<3>(H, velocity - predicted, noise_cov);
+    }
+
+    /**
+     * @brief correct with a full pose measurement (ICP result)
+     *
+     * @param pose measured map <- car transformation
+     * @param noise_cov covariance of [position, rotation]
+     */
+    void updatePose(const Eigen::Isometry3d &pose, const Matrix6d &noise_cov)
+    {
+        if (!initialized)
+        {
+            reset(pose, noise_cov.block<3, 3>(0, 0).trace() / 3, noise_cov.block<3, 3>(3, 3).trace() / 3);
+            return;
+        }
+
+        Eigen::Matrix<double, 6, 15> H = Eigen::Matrix<double, 6, 15>::Zero();
+        H.block<3, 3>(0, P) = Eigen::Matrix3d::Identity();
+        H.block<3, 3>(3, TH) = Eigen::Matrix3d::Identity();
+
+        Vector6d residual;
+        residual.head<3>() = pose.translation() - p;
+        residual.tail<3>() = logSO3(q.toRotationMatrix().transpose() * pose.linear());
+
+        correct<6>(H, residual, noise_cov);
+    }
+
+    Eigen::Isometry3d pose() const
+    {
+        Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+        T.linear() = q.toRotationMatrix();
+        T.translation() = p;
+        return T;
+    }
+
+    Eigen::Vector3d velocity() const { return v; }
+
+    /**
+     * @brief covariance of [position, rotation] for publishing
+     *
+     */
+    Matrix6d poseCovariance() const
+    {
+        Matrix6d c;
+        c.block<3, 3>(0, 0) = cov.block<3, 3>(P, P);
+        c.block<3, 3>(0, 3) = cov.block<3, 3>(P, TH);
+        c.block<3, 3>(3, 0) = cov.block<3, 3>(TH, P);
+        c.block<3, 3>(3, 3) = cov.block<3, 3>(TH, TH);
+        return c;
+    }
+
+private:
+    template <int M>
+    void correct(const Eigen::Matrix<double, M, 15> &H, const Eigen::Matrix<double, M, 1> &residual,
+                 const Eigen::Matrix<double, M, M> &noise_cov)
+    {
+        Eigen::Matrix<double, M, M> S = H * cov * H.transpose() + noise_cov;
+        Eigen::Matrix<double, 15, M> K = cov * H.transpose() * S.inverse();
+        ErrorVector dx = K * residual;
+
+        // inject the error into the nominal state
+        p += dx.segment<3>(P);
+        v += dx.segment<3>(V);
+        q = (q * Eigen::Quaterniond(expSO3(dx.segment<3>(TH)))).normalized();
+        ba += dx.segment<3>(BA);
+        bg += dx.segment<3>(BG);
+
+        // Joseph form keeps the covariance symmetric positive definite
+        ErrorMatrix IKH = ErrorMatrix::Identity() - K * H;
+        cov = IKH * cov * IKH.transpose() + K * noise_cov * K.transpose();
+    }
+
+    bool initialized;
+    Eigen::Vector3d gravity;
+    Noise noise;
+
+    Eigen::Vector3d p, v, ba, bg;
+    Eigen::Quaterniond q;
+    ErrorMatrix cov;
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif // ERROR_STATE_KF_H
@@ -0,0 +1,132 @@
+#ifndef FEATURE_REGISTRATION_H
+#define FEATURE_REGISTRATION_H
+
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "gn_registration.h"
+
+/**
+ * @brief Gauss-Newton registration of edge and planar scan features to a point map.
+ *
+ * The local structure of the map is fitted on the k nearest map points of a
+ * feature: edges are matched to the principal line (residual (I - d d^T)(T p - c)),
+ * planar points to the plane (residual n^T (T p - c)). Neighbourhoods that are
+ * neither line-like nor plane-like are skipped.
+ */
+class FeatureRegistration : public GaussNewtonRegistration
+{
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr target;
+    pcl::KdTreeFLANN<pcl::PointXYZI> tree;
+    int neighbours = 5;
+    size_t edgeCount = 0;
+
+protected:
+    int linearize(const Eigen::Isometry3d &T, Matrix6d &H, Vector6d &g, double &sqr_sum) override
+    {
+        double max_sqr = maxCorrespondenceDistance * maxCorrespondenceDistance;
+        std::vector<int> indices(neighbours);
+        std::vector<float> sqr_distances(neighbours);
+        int count = 0;
+
+        for (size_t i = 0; i < source.size(); i++)
+        {
+            Eigen::Vector3d world = T * source[i];
+            pcl::PointXYZI query;
+            query.x = world.x();
+            query.y = world.y();
+            query.z = world.z();
+            if (tree.nearestKSearch(query, neighbours, indices, sqr_distances) < neighbours ||
+                sqr_distances[neighbours - 1] > max_sqr)
+                continue;
+
+            Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+            for (int idx : indices)
+                mean += target->points[idx].getVector3fMap().cast<double>();
+            mean /= neighbours;
+            Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+            for (int idx : indices)
+            {
+                Eigen::Vector3d d = target->points[idx].getVector3fMap().cast<double>() - mean;
+                scatter += d * d.transpose();
+            }
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(scatter / neighbours);
+            const Eigen::Vector3d &lambda = solver.eigenvalues();
+
+            Eigen::Matrix<double, 3, 6> J_point;
+            J_point.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
+            J_point.block<3, 3>(0, 3) = -skew(world);
+
+            if (i < edgeCount)
+            {
+                if (lambda(2) < 3 * lambda(1))
+                    continue;
+                Eigen::Vector3d direction = solver.eigenvectors().col(2);
+                Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - direction * direction.transpose();
+                Eigen::Vector3d e = P * (world - mean);
+                Eigen::Matrix<double, 3, 6> J = P * J_point;
+                double w = robustWeight(e.norm());
+                H += w * J.transpose() * J;
+                g += w * J.transpose() * e;
+                sqr_sum += w * e.squaredNorm();
+                addResidual(e.norm());
+            }
+            else
+            {
+                if (lambda(1) < 3 * lambda(0))
+                    continue;
+                Eigen::Vector3d normal = solver.eigenvectors().col(0);
+                double residual = normal.dot(world - mean);
+                Vector6d J = J_point.transpose() * normal;
+                double w = robustWeight(residual);
+                H += w * J * J.transpose();
+                g += w * J * residual;
+                sqr_sum += w * residual * residual;
+                addResidual(residual);
+            }
+            count++;
+        }
+        return count;
+    }
+
+public:
+    void setInputTarget(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &map)
+    {
+        target = map;
+        tree.setInputCloud(map);
+    }
+
+    /** @brief map points fitted around a feature */
+    void setNeighbours(int k) { neighbours = k; }
+
+    /**
+     * @brief align edge and planar features to the map
+     *
+     * @param edges edge points of the scan
+     * @param planars planar points of the scan
+     * @param guess initial map <- scan transformation
+     * @return true if converged
+     */
+    template <typename PointT>
+    bool alignFeatures(const pcl::PointCloud<PointT> &edges, const pcl::PointCloud<PointT> &planars, const Eigen::Matrix4f &guess)
+    {
+        source.clear();
+        source.reserve(edges.size() + planars.size());
+        for (const auto &point : edges.points)
+            source.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+        for (const auto &point : planars.points)
+            source.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+        edgeCount = edges.size();
+        prepareSource();
+        bool result = optimize(toIsometry(guess));
+        // a plain align() treats every point as planar
+        edgeCount = 0;
+        return result;
+    }
+};
+
+#endif // FEATURE_REGISTRATION_H
@@ -0,0 +1,251 @@
+#ifndef GN_REGISTRATION_H
+#define GN_REGISTRATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <Eigen/Cholesky>
+#include <pcl/point_cloud.h>
+
+#include "se3_utils.h"
+
+/**
+ * @brief Gauss-Newton scan to map registration.
+ *
+ * Holds the scan, the stopping criteria and the iteration loop; a backend only
+ * provides linearize(), the normal equations of its cost at the current pose.
+ * The increment is a left perturbation T <- exp(delta) T with delta = [rho, phi].
+ * In planar mode only x, y and yaw are solved (a 3x3 system), z, roll and
+ * pitch stay those of the initial guess; vertical mode is the complement
+ * (z, roll and pitch), e.g. for ground points after a planar alignment.
+ *
+ * Outliers are handled by iteratively reweighted least squares: backends weight
+ * every residual with robustWeight() and report it with addResidual(); the
+ * first iteration is unweighted and the kernel scale is re-estimated after each
+ * iteration from the median absolute residual, so the rejection is
+ * deterministic and part of the same pass.
+ */
+class GaussNewtonRegistration
+{
+public:
+    enum Kernel
+    {
+        NONE,
+        HUBER,
+        CAUCHY,
+        GEMAN_MCCLURE
+    };
+
+    /**
+     * @brief kernel from its parameter name: none, huber, cauchy or geman_mcclure
+     *
+     */
+    static bool parseKernel(const std::string &name, Kernel &kernel)
+    {
+        if (name == "none")
+            kernel = NONE;
+        else if (name == "huber")
+            kernel = HUBER;
+        else if (name == "cauchy")
+            kernel = CAUCHY;
+        else if (name == "geman_mcclure")
+            kernel = GEMAN_MCCLURE;
+        else
+            return false;
+        return true;
+    }
+
+protected:
+    std::vector<Eigen::Vector3d> source;
+
+    int maxIterations;
+    double maxCorrespondenceDistance;
+    double transformationEpsilon;
+    bool planar;
+    bool vertical;
+    Kernel kernel;
+    double robustScale; // 0 (unweighted) until the first iteration estimated it
+    std::vector<double> residuals;
+
+    Eigen::Matrix4f finalTransformation;
+    int iterations;
+    bool converged;
+    double fitness;
+
+    /**
+     * @brief called once per align() after the scan is copied, e.g. for per point statistics
+     *
+     */
+    virtual void prepareSource() {}
+
+    /**
+     * @brief accumulate the normal equations at pose T
+     *
+     * @param T current map <- scan transformation
+     * @param H J^T W J
+     * @param g J^T W r
+     * @param sqr_sum sum of the squared (weighted) residuals
+     * @return number of correspondences
+     */
+    virtual int linearize(const Eigen::Isometry3d &T, Matrix6d &H, Vector6d &g, double &sqr_sum) = 0;
+
+    /**
+     * @brief IRLS weight of a residual with the current kernel and scale
+     *
+     */
+    double robustWeight(double residual) const
+    {
+        if (kernel == NONE || robustScale <= 0)
+            return 1.0;
+
+        double r = std::abs(residual);
+        switch (kernel)
+        {
+        case HUBER:
+        {
+            double c = 1.345 * robustScale;
+            return r <= c ? 1.0 : c / r;
+        }
+        case CAUCHY:
+        {
+            double c = 2.3849 * robustScale;
+            return 1.0 / (1.0 + (r * r) / (c * c));
+        }
+        case GEMAN_MCCLURE:
+        {
+            double c2 = robustScale * robustScale;
+            return c2 * c2 / ((c2 + r * r) * (c2 + r * r));
+        }
+        default:
+            return 1.0;
+        }
+    }
+
+    /** @brief record a residual for the scale of the next iteration */
+    void addResidual(double residual)
+    {
+        if (kernel != NONE)
+            residuals.push_back(std::abs(residual));
+    }
+
+public:
+    GaussNewtonRegistration()
+        : maxIterations(30), maxCorrespondenceDistance(1.0), transformationEpsilon(1e-4), planar(false), vertical(false),
+          kernel(NONE), robustScale(0),
+          finalTransformation(Eigen::Matrix4f::Identity()), iterations(0), converged(false), fitness(0) {}
+
+    virtual ~GaussNewtonRegistration() {}
+
+    void setMaximumIterations(int n) { maxIterations = n; }
+    void setMaxCorrespondenceDistance(double d) { maxCorrespondenceDistance = d; }
+    /** @brief norm of the twist increment below which the registration has converged */
+    void setTransformationEpsilon(double e) { transformationEpsilon = e; }
+    /** @brief solve x, y and yaw only */
+    void setPlanar(bool p) { planar = p; }
+    /** @brief solve z, roll and pitch only */
+    void setVertical(bool v) { vertical = v; }
+    void setRobustKernel(Kernel k) { kernel = k; }
+    /** @brief kernel scale of the last iteration, estimated from the residuals */
+    double getRobustScale() const { return robustScale; }
+
+    Eigen::Matrix4f getFinalTransformation() const { return finalTransformation; }
+    int getIterations() const { return iterations; }
+    bool hasConverged() const { return converged; }
+    /** @brief mean squared residual of the correspondences */
+    double getFitnessScore() const { return fitness; }
+
+    /**
+     * @brief align a scan to the map
+     *
+     * @param cloud scan points
+     * @param guess initial map <- scan transformation
+     * @return true if converged
+     */
+    template <typename PointT>
+    bool align(const pcl::PointCloud<PointT> &cloud, const Eigen::Matrix4f &guess)
+    {
+        source.clear();
+        source.reserve(cloud.size());
+        for (const auto &point : cloud.points)
+            source.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+        prepareSource();
+        return optimize(toIsometry(guess));
+    }
+
+protected:
+    bool optimize(Eigen::Isometry3d T)
+    {
+        converged = false;
+        iterations = 0;
+        // residuals of a new scan are larger than at the end of the last one, start unweighted
+        robustScale = 0;
+        while (iterations < maxIterations)
+        {
+            Matrix6d H = Matrix6d::Zero();
+            Vector6d g = Vector6d::Zero();
+            double sqr_sum = 0;
+            residuals.clear();
+            int count = linearize(T, H, g, sqr_sum);
+            updateScale();
+
+            iterations++;
+            if (count < 6)
+                break;
+            fitness = sqr_sum / count;
+
+            static const int planar_axes[3] = {0, 1, 5};
+            static const int vertical_axes[3] = {2, 3, 4};
+            Vector6d delta = planar     ? solveAxes(H, g, planar_axes)
+                             : vertical ? solveAxes(H, g, vertical_axes)
+                                        : Vector6d(H.ldlt().solve(-g));
+            T = expSE3(delta) * T;
+            if (delta.norm() < transformationEpsilon)
+            {
+                converged = true;
+                break;
+            }
+        }
+
+        finalTransformation = T.matrix().cast<float>();
+        return converged;
+    }
+
+    /**
+     * @brief robust scale from the median absolute residual (MAD)
+     *
+     */
+    void updateScale()
+    {
+        if (kernel == NONE || residuals.size() < 6)
+            return;
+        std::vector<double>::iterator median = residuals.begin() + residuals.size() / 2;
+        std::nth_element(residuals.begin(), median, residuals.end());
+        robustScale = std::max(1.4826 * *median, 1e-3);
+    }
+
+    /**
+     * @brief increment restricted to three twist axes, e.g. [rho_x, rho_y, phi_z]
+     *
+     */
+    static Vector6d solveAxes(const Matrix6d &H, const Vector6d &g, const int axes[3])
+    {
+        Eigen::Matrix3d H_planar;
+        Eigen::Vector3d g_planar;
+        for (int i = 0; i < 3; i++)
+        {
+            g_planar(i) = g(axes[i]);
+            for (int j = 0; j < 3; j++)
+                H_planar(i, j) = H(axes[i], axes[j]);
+        }
+        Eigen::Vector3d solution = H_planar.ldlt().solve(-g_planar);
+
+        Vector6d delta = Vector6d::Zero();
+        for (int i = 0; i < 3; i++)
+            delta(axes[i]) = solution(i);
+        return delta;
+    }
+};
+
+#endif // GN_REGISTRATION_H
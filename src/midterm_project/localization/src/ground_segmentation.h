@@ -0,0 +1,126 @@
+#ifndef GROUND_SEGMENTATION_H
+#define GROUND_SEGMENTATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+
+#include "voxel_hash.h"
+
+/**
+ * @brief Ground / non-ground split by a plane fit per grid cell.
+ *
+ * The cloud is cut into square cells in x-y. In every cell the seeds are the
+ * points less than seedHeight above the mean of its lowest points, a plane is
+ * fitted to them (PCA) and refitted a few times on the points within
+ * distanceThreshold of it. A cell whose plane is steeper than maxSlope has no
+ * ground. Fitting per cell follows slopes and ramps that a fixed z band cuts.
+ * The same settings split clouds of any point type (scan, features, map with
+ * normals).
+ */
+class GroundSegmentation
+{
+public:
+    double cellSize = 10.0;
+    double seedHeight = 0.5;
+    int seedPoints = 20;
+    double distanceThreshold = 0.2;
+    double maxSlope = 15.0; // degrees
+    int iterations = 3;
+    int minPoints = 10;
+
+    /**
+     * @brief split a cloud, works in any frame with z up
+     *
+     * @param cloud car frame scan or world frame map
+     * @param ground points on the fitted planes
+     * @param non_ground all other points
+     */
+    template <typename PointT>
+    void segment(const pcl::PointCloud<PointT> &cloud, pcl::PointCloud<PointT> &ground, pcl::PointCloud<PointT> &non_ground) const
+    {
+        ground.clear();
+        non_ground.clear();
+
+        std::unordered_map<Eigen::Vector3i, std::vector<int>, VoxelKeyHash> cells;
+        for (size_t i = 0; i < cloud.size(); i++)
+        {
+            const PointT &p = cloud.points[i];
+            if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                continue;
+            Eigen::Vector3i key(int(std::floor(p.x / cellSize)), int(std::floor(p.y / cellSize)), 0);
+            cells[key].push_back(int(i));
+        }
+
+        std::vector<char> is_ground(cloud.size(), 0);
+        std::vector<float> heights;
+        std::vector<int> inliers;
+        double min_normal_z = std::cos(maxSlope * M_PI / 180.0);
+        for (const auto &cell : cells)
+        {
+            const std::vector<int> &indices = cell.second;
+            if ((int)indices.size() < minPoints)
+                continue;
+
+            // lowest point representative
+            heights.clear();
+            for (int idx : indices)
+                heights.push_back(cloud.points[idx].z);
+            int lowest = std::min<int>(seedPoints, heights.size());
+            std::nth_element(heights.begin(), heights.begin() + (lowest - 1), heights.end());
+            double seed_level = 0;
+            for (int k = 0; k < lowest; k++)
+                seed_level += heights[k];
+            seed_level = seed_level / lowest + seedHeight;
+
+            inliers.clear();
+            for (int idx : indices)
+                if (cloud.points[idx].z < seed_level)
+                    inliers.push_back(idx);
+
+            bool flat = false;
+            for (int it = 0; it < iterations && inliers.size() >= 3; it++)
+            {
+                Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+                for (int idx : inliers)
+                    mean += cloud.points[idx].getVector3fMap().template cast<double>();
+                mean /= inliers.size();
+                Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+                for (int idx : inliers)
+                {
+                    Eigen::Vector3d d = cloud.points[idx].getVector3fMap().template cast<double>() - mean;
+                    scatter += d * d.transpose();
+                }
+                Eigen::Vector3d normal = Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(scatter).eigenvectors().col(0);
+                flat = std::abs(normal.z()) >= min_normal_z;
+                if (!flat)
+                    break;
+
+                inliers.clear();
+                for (int idx : indices)
+                    if (std::abs(normal.dot(cloud.points[idx].getVector3fMap().template cast<double>() - mean)) < distanceThreshold)
+                        inliers.push_back(idx);
+            }
+            if (flat)
+                for (int idx : inliers)
+                    is_ground[idx] = 1;
+        }
+
+        for (size_t i = 0; i < cloud.size(); i++)
+        {
+            const PointT &p = cloud.points[i];
+            if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                continue;
+            if (is_ground[i])
+                ground.push_back(p);
+            else
+                non_ground.push_back(p);
+        }
+    }
+};
+
+#endif // GROUND_SEGMENTATION_H
@@ -0,0 +1,148 @@
+#ifndef ICP_COVARIANCE_H
+#define ICP_COVARIANCE_H
+
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+#include "se3_utils.h"
+
+/**
+ * @brief Uncertainty of a registration result
+ *
+ */
+struct RegistrationCovariance
+{
+    Matrix6d covariance;      // [x, y, z, roll, pitch, yaw] in map frame, ROS ordering
+    Matrix6d covariance_car;  // [translation, rotation] of a right perturbation, car frame
+    Matrix6d hessian;         // J^T J in the car frame
+    Vector6d eigenvalues;     // of the hessian normalized by the correspondence count
+    int degenerate_directions; // eigen directions below the threshold
+    int correspondences;
+    double residual_variance;
+};
+
+/**
+ * @brief approximate the registration covariance from the point-to-plane Hessian at convergence
+ *
+ * Each scan point paired with the map gives the residual n^T (T p - q) whose
+ * Jacobian w.r.t. a car frame perturbation is [n_c^T, (p x n_c)^T]. The covariance
+ * is sigma^2 (J^T J)^-1; directions whose normalized eigenvalue is below
+ * degenerate_threshold are not constrained by the scene and get degenerate_variance.
+ *
+ * @param source scan points in car frame (input of the registration)
+ * @param transform registration result, map <- car
+ * @param target_search search structure over the map used by the registration
+ * @param max_distance correspondence gate
+ * @param degenerate_threshold normalized eigenvalue below which a direction is degenerate
+ * @param degenerate_variance variance assigned to degenerate directions
+ * @param result covariance and diagnostics
+ * @return false if there are not enough correspondences
+ */
+template <typename PointT>
+bool estimateRegistrationCovariance(const pcl::PointCloud<PointT> &source, const Eigen::Matrix4f &transform,
+                                    const pcl::search::Search<PointT> &target_search, double max_distance,
+                                    double degenerate_threshold, double degenerate_variance,
+                                    RegistrationCovariance &result)
+{
+    const int k = 5;
+    const pcl::PointCloud<PointT> &target = *target_search.getInputCloud();
+    Eigen::Matrix4d T = transform.cast<double>();
+    Eigen::Matrix3d R = T.block<3, 3>(0, 0);
+    double max_sqr = max_distance * max_distance;
+
+    Matrix6d H = Matrix6d::Zero();
+    double sqr_sum = 0;
+    int count = 0;
+    std::vector<int> indices(k);
+    std::vector<float> sqr_distances(k);
+
+    for (const auto &point : source.points)
+    {
+        Eigen::Vector3d p(point.x, point.y, point.z);
+        Eigen::Vector3d world = R * p + T.block<3, 1>(0, 3);
+
+        PointT query = point;
+        query.x = world.x();
+        query.y = world.y();
+        query.z = world.z();
+        if (target_search.nearestKSearch(query, k, indices, sqr_distances) < k || sqr_distances[0] > max_sqr)
+            continue;
+
+        // local plane of the map around the correspondence
+        Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+        for (int idx : indices)
+            mean += Eigen::Vector3d(target.points[idx].x, target.points[idx].y, target.points[idx].z);
+        mean /= k;
+        Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+        for (int idx : indices)
+        {
+            Eigen::Vector3d d = Eigen::Vector3d(target.points[idx].x, target.points[idx].y, target.points[idx].z) - mean;
+            scatter += d * d.transpose();
+        }
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> plane(scatter);
+        Eigen::Vector3d normal = plane.eigenvectors().col(0);
+
+        const PointT &nearest = target.points[indices[0]];
+        double residual = normal.dot(world - Eigen::Vector3d(nearest.x, nearest.y, nearest.z));
+
+        Eigen::Vector3d normal_car = R.transpose() * normal;
+        Vector6d J;
+        J.head<3>() = normal_car;
+        J.tail<3>() = p.cross(normal_car);
+        H += J * J.transpose();
+        sqr_sum += residual * residual;
+        count++;
+    }
+
+    result.correspondences = count;
+    if (count <= 6)
+        return false;
+
+    result.hessian = H;
+    result.residual_variance = sqr_sum / (count - 6);
+
+    Eigen::SelfAdjointEigenSolver<Matrix6d> solver(H / count);
+    result.eigenvalues = solver.eigenvalues();
+    result.degenerate_directions = 0;
+
+    Vector6d variances;
+    for (int i = 0; i < 6; i++)
+    {
+        if (result.eigenvalues(i) < degenerate_threshold)
+        {
+            variances(i) = degenerate_variance;
+            result.degenerate_directions++;
+        }
+        else
+            variances(i) = result.residual_variance / (result.eigenvalues(i) * count);
+    }
+    result.covariance_car = solver.eigenvectors() * variances.asDiagonal() * solver.eigenvectors().transpose();
+
+    // car frame perturbation -> map frame
+    Matrix6d rotate = Matrix6d::Zero();
+    rotate.block<3, 3>(0, 0) = R;
+    rotate.block<3, 3>(3, 3) = R;
+    result.covariance = rotate * result.covariance_car * rotate.transpose();
+    return true;
+}
+
+/**
+ * @brief registration covariance in the residual convention of ErrorStateKF::updatePose
+ *
+ * The filter takes the position error in the map frame and the rotation error
+ * on the right, in the car frame, so only the translation rows are rotated.
+ *
+ * @param covariance_car covariance of the car frame right perturbation
+ * @param rotation orientation of the registration result, map <- car
+ */
+inline Matrix6d filterPoseCovariance(const Matrix6d &covariance_car, const Eigen::Matrix3d &rotation)
+{
+    Matrix6d rotate = Matrix6d::Identity();
+    rotate.block<3, 3>(0, 0) = rotation;
+    return rotate * covariance_car * rotate.transpose();
+}
+
+#endif // ICP_COVARIANCE_H
@@ -1,4 +1,7 @@
 #include "math.h"
+#include <chrono>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include "stdio.h"
 #include <fstream>
@@ -16,15 +19,38 @@
 #include <pcl_ros/transforms.h>
 #include <tf2_eigen/tf2_eigen.h>
 #include <pcl/registration/icp.h>
+#include <pcl/registration/transformation_estimation_2D.h>
 #include <tf/transform_listener.h>
 #include <pcl/filters/voxel_grid.h>
 #include <tf/transform_datatypes.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
 #include <pcl/filters/passthrough.h>
+#include <pcl/common/io.h>
+#include <pcl/common/transforms.h>
 #include <tf/transform_broadcaster.h>
 #include <tf2/LinearMath/Matrix3x3.h>
+#include <ros/callback_queue.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include "state_buffer.h"
+#include "pose_interpolation.h"
+#include "motion_predictor.h"
+#include "icp_registration.h"
+#include "registration_pyramid.h"
+#include "point_to_plane.h"
+#include "voxel_gicp.h"
+#include "scan_features.h"
+#include "feature_registration.h"
+#include "ground_segmentation.h"
+#include "range_image.h"
+#include "scan_budget.h"
+#include "information_sampling.h"
+#include "deskew.h"
+#include "map_occupancy.h"
+#include "local_origin.h"
+#include "pose_output.h"
+
 class icp_localization
 {
 
@@ -41,25 +67,87 @@ private:
 	tf::TransformListener tf_listener;
 	tf::TransformBroadcaster tf_broadcaster;
 
+	// sensor callbacks run on their own queue so they never wait behind ICP
+	ros::NodeHandle sensor_nh;
+	ros::CallbackQueue sensor_queue;
+	ros::AsyncSpinner sensor_spinner;
+
 	// =============== variables of transformation ===============
 	bool use_gps;
 	bool use_odom;
 	double odom_ratio;
 	double lidar_ratio;
 	double frequency_ratio;
-	double odom_x, odom_y, odom_z;
 	double diff_x, diff_y, diff_z;
+	StateBuffer<StampedState> odom_buffer;
+	bool interpolate_odom;
+	double max_odom_extrapolation;
+	bool has_previous_odom;
+	Eigen::Isometry3d previous_odom_pose;
+	Eigen::Matrix4f previous_result;
+	// every point of a sweep moved to the lidar pose at the scan stamp with the buffered odometry
+	bool use_deskew;
+	double scan_period;
+	bool scan_stamp_at_end;
+	ScanDeskew deskew;
+	bool use_motion_model;
+	double motion_blend_weight;
+	MotionPredictor motion_predictor;
+
+	// anytime ICP: wall-clock budget per scan in seconds, 0 runs until convergence
+	double icp_time_budget;
+	int icp_budget_chunk;
+
+	// coarse-to-fine levels run before the full resolution ICP, empty disables it
+	std::vector<float> pyramid_leaf_sizes;
+	RegistrationPyramid<pcl::PointXYZI> pyramid;
+
+	// "icp" (pcl point-to-point), "point_to_plane" against the map with normals, "vgicp" against the voxelized map
+	// or "features" (edge and planar scan points instead of the downsampled scan)
+	std::string registration;
+	std::unique_ptr<GaussNewtonRegistration> gn_registration;
+	FeatureRegistration *feature_registration;
+	VoxelGICP *vgicp_registration;
+	ScanFeatureExtractor<pcl::PointXYZI> feature_extractor;
+	// x, y, yaw only, z roll and pitch are kept from the prior
+	bool planar_registration;
+	// ground split by a plane fit per cell instead of z bands: non-ground drives x, y, yaw and
+	// the ground is registered to the map ground for z, roll, pitch
+	bool use_ground_segmentation;
+	GroundSegmentation ground_segmentation;
+	std::unique_ptr<PointToPlaneRegistration> ground_registration;
+	// scan preprocessing on a ring x azimuth image instead of voxel grids, vgicp takes its normals
+	bool use_range_image;
+	ScanRangeImage range_image;
+	int range_row_step, range_column_step;
+	// target size of the downsampled scan, the leaf adapts to the scene density (0 keeps the fixed leaf)
+	int scan_point_budget;
+	AdaptiveVoxelFilter<pcl::PointXYZI> scan_budget;
+	// keep only this many scan points, chosen to cover all constraint directions (0 disables)
+	int information_budget;
+	int information_normal_k;
+	// scan points in map voxels that are empty after the coarse alignment are dropped before the final registration
+	std::unique_ptr<MapOccupancy> map_occupancy;
+	// point_to_plane correspondences from a voxel-hashed local map that follows the car
+	std::unique_ptr<VoxelLocalMap<MapPoint>> local_map;
+
+	// high rate pose between lidar frames, propagated with odometry on its own thread
+	bool high_rate_output;
+	std::unique_ptr<PoseOutput> pose_output;
 	Eigen::Matrix4f initial_guess;
 	sensor_msgs::PointCloud2 Final_map;
 	Eigen::Matrix4f c2l_eigen_transform;
 	sensor_msgs::PointCloud2 Final_cloud;
 	double init_x, init_y, init_z,init_yaw;
 	pcl::PointCloud<pcl::PointXYZI>::Ptr map;
+	// the map the scans are registered to: the z band of use_filter applied once at load, or the non-ground map
+	pcl::PointCloud<pcl::PointXYZI>::Ptr registration_map;
 
 	// =============== variables of output file ===============
 	std::ofstream outfile;
 	std::ofstream transformation_record;
-	std::string map_path, result_path, transformation_path;
+	std::ofstream stats_record;
+	std::string map_path, result_path, transformation_path, stats_path;
 
 	// =============== variables of ICP parameters ===============
 	int total_frame;
@@ -68,6 +156,15 @@ private:
 	double map_leaf_size;
 	double scan_leaf_size;
 	double previous_score;
+	long total_iterations;
+	// Anderson accelerated ICP, benchmark also runs the plain ICP on every frame for comparison
+	int anderson_depth;
+	bool benchmark_anderson;
+	long total_baseline_iterations;
+	// point-to-point ICP and the pyramid levels run around a moving origin near the car instead of world coordinates
+	bool use_local_origin;
+	LocalOrigin local_origin;
+	pcl::PointCloud<pcl::PointXYZI>::Ptr local_map_cloud;
 
 public:
 	int frame_number;
@@ -77,25 +174,114 @@ public:
 	 *
 	 * @param _nh ros node handler
 	 */
-	icp_localization(ros::NodeHandle _nh) : map(new pcl::PointCloud<pcl::PointXYZI>)
+	icp_localization(ros::NodeHandle _nh) : sensor_spinner(1, &sensor_queue), map(new pcl::PointCloud<pcl::PointXYZI>)
 	{
 
 		std::vector<float> trans, rot;
 		std::cout << "Initializing ICP...\n";
 		this->nh = _nh;
+		this->sensor_nh = _nh;
+		this->sensor_nh.setCallbackQueue(&this->sensor_queue);
 
 		// grasping ros parameters
 		_nh.param<bool>("use_gps", use_gps, true);
 		_nh.param<double>("init_x", init_x, 0.15);
 		_nh.param<double>("init_y", init_y, 0.15);
 		_nh.param<double>("init_z", init_z, 0.15);
-		_nh.param<bool>("use_odom", use_gps, true);
+		_nh.param<bool>("use_odom", use_odom, true);
 		_nh.param<double>("fix_rate", fix_rate, 1.0);
 		_nh.param<double>("init_yaw", init_yaw, 0.15);
 		_nh.param<int>("total_frame", total_frame, 1);
 		_nh.param<bool>("use_filter", use_filter, true);
 		_nh.param<double>("odom_ratio", odom_ratio, 1.0);
 		_nh.param<double>("lidar_ratio", lidar_ratio, 1.0);
+		_nh.param<bool>("interpolate_odom", interpolate_odom, false);
+		_nh.param<double>("max_odom_extrapolation", max_odom_extrapolation, 0.1);
+		_nh.param<bool>("use_motion_model", use_motion_model, false);
+		_nh.param<bool>("use_deskew", use_deskew, false);
+		_nh.param<double>("scan_period", scan_period, 0.05);
+		_nh.param<bool>("scan_stamp_at_end", scan_stamp_at_end, true);
+		_nh.param<int>("deskew_bins", deskew.bins, 64);
+		_nh.param<double>("motion_blend_weight", motion_blend_weight, 0.5);
+		_nh.param<std::string>("stats_path", stats_path, "");
+		_nh.param<double>("icp_time_budget", icp_time_budget, 0.0);
+		_nh.param<int>("icp_budget_chunk", icp_budget_chunk, 5);
+		_nh.param<int>("anderson_depth", anderson_depth, 0);
+		_nh.param<bool>("benchmark_anderson", benchmark_anderson, false);
+		double recenter_distance;
+		_nh.param<bool>("use_local_origin", use_local_origin, false);
+		_nh.param<double>("recenter_distance", recenter_distance, 50.0);
+		this->local_origin = LocalOrigin(recenter_distance);
+		this->local_map_cloud.reset(new pcl::PointCloud<pcl::PointXYZI>);
+		double pyramid_distance_factor;
+		int pyramid_max_iterations;
+		_nh.param<std::vector<float>>("pyramid_leaf_sizes", pyramid_leaf_sizes, std::vector<float>());
+		_nh.param<double>("pyramid_distance_factor", pyramid_distance_factor, 3.0);
+		_nh.param<int>("pyramid_max_iterations", pyramid_max_iterations, 30);
+		std::string normal_map_path;
+		int normal_k, plane_max_iterations;
+		double plane_max_correspondence, correspondence_reuse;
+		_nh.param<std::string>("registration", registration, "icp");
+		_nh.param<bool>("planar_registration", planar_registration, false);
+		std::string robust_kernel;
+		_nh.param<std::string>("robust_kernel", robust_kernel, "none");
+		_nh.param<std::string>("normal_map_path", normal_map_path, "");
+		_nh.param<int>("normal_k", normal_k, 10);
+		_nh.param<int>("plane_max_iterations", plane_max_iterations, 30);
+		_nh.param<double>("plane_max_correspondence", plane_max_correspondence, 1.0);
+		_nh.param<double>("correspondence_reuse", correspondence_reuse, 0.0);
+		double vgicp_resolution;
+		int vgicp_voxel_neighbours, vgicp_max_iterations;
+		_nh.param<double>("vgicp_resolution", vgicp_resolution, 1.0);
+		_nh.param<int>("vgicp_voxel_neighbours", vgicp_voxel_neighbours, 7);
+		_nh.param<int>("vgicp_max_iterations", vgicp_max_iterations, 30);
+		_nh.param<bool>("use_ground_segmentation", use_ground_segmentation, false);
+		_nh.param<double>("ground_cell_size", ground_segmentation.cellSize, 10.0);
+		_nh.param<double>("ground_distance", ground_segmentation.distanceThreshold, 0.2);
+		_nh.param<double>("ground_max_slope", ground_segmentation.maxSlope, 15.0);
+		_nh.param<bool>("use_range_image", use_range_image, false);
+		_nh.param<int>("range_image_columns", range_image.columns, 1080);
+		_nh.param<double>("range_min", range_image.minRange, 1.0);
+		_nh.param<double>("range_max", range_image.maxRange, 100.0);
+		_nh.param<int>("range_row_step", range_row_step, 1);
+		_nh.param<int>("range_column_step", range_column_step, 2);
+		double budget_max_scale;
+		_nh.param<int>("scan_point_budget", scan_point_budget, 0);
+		_nh.param<double>("budget_max_scale", budget_max_scale, 10.0);
+		_nh.param<int>("information_budget", information_budget, 0);
+		_nh.param<int>("information_normal_k", information_normal_k, 10);
+		bool dynamic_filter;
+		double occupancy_resolution, dynamic_coarse_leaf;
+		int occupancy_neighbours;
+		_nh.param<bool>("dynamic_filter", dynamic_filter, false);
+		_nh.param<double>("occupancy_resolution", occupancy_resolution, 0.5);
+		_nh.param<int>("occupancy_neighbours", occupancy_neighbours, 27);
+		_nh.param<double>("dynamic_coarse_leaf", dynamic_coarse_leaf, 1.0);
+		int feature_neighbours;
+		_nh.param<int>("lidar_rings", feature_extractor.geometry.rings, 32);
+		_nh.param<double>("lidar_min_elevation", feature_extractor.geometry.minElevation, -30.67);
+		_nh.param<double>("lidar_max_elevation", feature_extractor.geometry.maxElevation, 10.67);
+		_nh.param<int>("feature_sectors", feature_extractor.sectors, 6);
+		_nh.param<int>("feature_edges_per_sector", feature_extractor.edgesPerSector, 4);
+		_nh.param<int>("feature_planars_per_sector", feature_extractor.planarsPerSector, 8);
+		_nh.param<double>("feature_edge_threshold", feature_extractor.edgeThreshold, 0.2);
+		_nh.param<double>("feature_planar_threshold", feature_extractor.planarThreshold, 0.02);
+		_nh.param<int>("feature_neighbours", feature_neighbours, 5);
+		this->range_image.geometry = this->feature_extractor.geometry;
+		this->scan_budget.setTarget(this->scan_point_budget);
+		this->scan_budget.setScaleLimits(0.5, budget_max_scale);
+		if (!this->use_ground_segmentation)
+			this->scan_budget.setHeightLimits(1.0, 7.5);
+		bool use_local_map;
+		double local_map_radius;
+		int local_map_points;
+		_nh.param<bool>("use_local_map", use_local_map, false);
+		_nh.param<double>("local_map_radius", local_map_radius, 100.0);
+		_nh.param<int>("local_map_points", local_map_points, 20);
+		double output_rate, output_max_extrapolation;
+		_nh.param<bool>("high_rate_output", high_rate_output, false);
+		_nh.param<double>("output_rate", output_rate, 100.0);
+		_nh.param<double>("output_max_extrapolation", output_max_extrapolation, 0.05);
 		_nh.param<double>("mapLeafSize", map_leaf_size, 0.15);
 		_nh.param<double>("scanLeafSize", scan_leaf_size, 0.15);
 		_nh.param<std::string>("map_path", map_path, "nuscenes_map.pcd");
@@ -104,19 +290,39 @@ public:
 		_nh.param<std::vector<float>>("baselink2lidar_trans", trans, std::vector<float>());
 		_nh.param<std::string>("transformation_path", transformation_path, "transformation.txt");
 
-		this->odom_x = 0;
-		this->odom_y = 0;
-		this->odom_z = 0;
 		this->diff_x = 0;
 		this->diff_y = 0;
 		this->diff_z = 0;
+		this->has_previous_odom = false;
 		this->frame_number = 0;
 		this->previous_score = 0;
-		this->pub_map = nh.advertise<sensor_msgs::PointCloud2>("/map", 1);
+		this->total_iterations = 0;
+		this->total_baseline_iterations = 0;
+		this->feature_registration = nullptr;
+		this->vgicp_registration = nullptr;
+		// latched, the whole map is sent once at startup and only the cropped map per scan
+		this->pub_map = nh.advertise<sensor_msgs::PointCloud2>("/map", 1, true);
 		this->pub_lidar = this->nh.advertise<sensor_msgs::PointCloud2>("/transformed_points", 1);
+		if (this->use_deskew && !this->use_odom)
+		{
+			ROS_WARN("use_deskew needs use_odom, scans are not deskewed");
+			this->use_deskew = false;
+		}
+		if (this->interpolate_odom && !this->use_odom)
+		{
+			ROS_WARN("interpolate_odom needs use_odom, using the last ICP result as initial guess");
+			this->interpolate_odom = false;
+		}
 		if(this->use_odom)
-			this->sub_odom = this->nh.subscribe("/wheel_odometry", 4000000, &icp_localization::odom_callback, this);
+			this->sub_odom = this->sensor_nh.subscribe("/wheel_odometry", 4000000, &icp_localization::odom_callback, this);
 		this->sub_lidar_scan = this->nh.subscribe("/lidar_points", 4000000, &icp_localization::lidar_scanning, this);
+		this->sensor_spinner.start();
+		if (this->high_rate_output)
+		{
+			ros::Publisher pub_extrapolated = this->nh.advertise<geometry_msgs::PoseStamped>("/extrapolated_pose", 100);
+			this->pose_output.reset(new PoseOutput(this->odom_buffer, pub_extrapolated, "world", output_rate, output_max_extrapolation));
+			this->pose_output->start();
+		}
 
 
 		// 把itri.yaml中的transform link存下來
@@ -139,6 +345,156 @@ public:
 			exit(0);
 		}
 
+		// the horizontal alignment sees the non-ground map only, the map ground gets normals for the vertical one
+		if (this->use_ground_segmentation)
+		{
+			pcl::PointCloud<pcl::PointXYZI>::Ptr map_ground(new pcl::PointCloud<pcl::PointXYZI>);
+			pcl::PointCloud<pcl::PointXYZI>::Ptr map_non_ground(new pcl::PointCloud<pcl::PointXYZI>);
+			this->ground_segmentation.segment(*this->map, *map_ground, *map_non_ground);
+			ROS_INFO("map ground: %zu of %zu points", map_ground->size(), this->map->size());
+			this->map = map_non_ground;
+
+			NormalMap::Ptr ground_normals(new NormalMap);
+			estimateMapNormals<pcl::PointXYZI>(map_ground, normal_k, *ground_normals);
+			this->ground_registration.reset(new PointToPlaneRegistration);
+			this->ground_registration->setInputTarget(ground_normals);
+			this->ground_registration->setVertical(true);
+			this->ground_registration->setMaximumIterations(plane_max_iterations);
+			this->ground_registration->setMaxCorrespondenceDistance(plane_max_correspondence);
+			if (!this->planar_registration)
+				ROS_INFO("ground segmentation: registering non-ground points in x, y, yaw only");
+			this->planar_registration = true;
+		}
+
+		// every registration target is built from the same band, per scan only x and y are cropped
+		bool height_band = this->use_filter && !this->use_ground_segmentation;
+		this->registration_map = this->map;
+		if (height_band)
+		{
+			this->registration_map.reset(new pcl::PointCloud<pcl::PointXYZI>);
+			pcl::PassThrough<pcl::PointXYZI> height_filter;
+			height_filter.setInputCloud(this->map);
+			height_filter.setFilterFieldName("z");
+			height_filter.setFilterLimits(1, 8);
+			height_filter.filter(*this->registration_map);
+			ROS_INFO("registration map: %zu of %zu points with z in [1, 8]", this->registration_map->size(), this->map->size());
+		}
+
+		// map normals come from merge_pcd, estimating them here is only a fallback
+		if (this->registration == "point_to_plane")
+		{
+			NormalMap::Ptr normal_map(new NormalMap);
+			if (normal_map_path.empty() || pcl::io::loadPCDFile<MapPoint>(normal_map_path, *normal_map) == -1)
+			{
+				ROS_WARN("no map with normals at '%s', estimating normals of %s", normal_map_path.c_str(), map_path.c_str());
+				estimateMapNormals<pcl::PointXYZI>(this->registration_map, normal_k, *normal_map);
+			}
+			else if (height_band)
+			{
+				pcl::PassThrough<MapPoint> height_filter;
+				height_filter.setInputCloud(normal_map->makeShared());
+				height_filter.setFilterFieldName("z");
+				height_filter.setFilterLimits(1, 8);
+				height_filter.filter(*normal_map);
+			}
+			else if (this->use_ground_segmentation)
+			{
+				NormalMap normal_ground, normal_non_ground;
+				this->ground_segmentation.segment(*normal_map, normal_ground, normal_non_ground);
+				ROS_INFO("map with normals: %zu ground points removed", normal_ground.size());
+				normal_map->swap(normal_non_ground);
+			}
+			PointToPlaneRegistration *plane = new PointToPlaneRegistration;
+			plane->setMaximumIterations(plane_max_iterations);
+			plane->setMaxCorrespondenceDistance(plane_max_correspondence);
+			if (use_local_map)
+			{
+				// voxel edge equal to the correspondence gate keeps a query within 27 voxels
+				this->local_map.reset(new VoxelLocalMap<MapPoint>(plane_max_correspondence, local_map_points, local_map_radius));
+				this->local_map->setGlobalMap(*normal_map);
+				plane->setLocalMap(this->local_map.get());
+			}
+			else
+			{
+				plane->setInputTarget(normal_map);
+				plane->setCorrespondenceReuse(correspondence_reuse);
+			}
+			this->gn_registration.reset(plane);
+		}
+		else if (this->registration == "vgicp")
+		{
+			this->vgicp_registration = new VoxelGICP;
+			this->vgicp_registration->setResolution(vgicp_resolution);
+			this->vgicp_registration->setVoxelNeighbours(vgicp_voxel_neighbours);
+			this->vgicp_registration->setMaximumIterations(vgicp_max_iterations);
+			this->vgicp_registration->setInputTarget(*this->registration_map);
+			ROS_INFO("vgicp target: %zu voxels of %.2f m", this->vgicp_registration->voxelCount(), vgicp_resolution);
+			this->gn_registration.reset(this->vgicp_registration);
+		}
+		else if (this->registration == "features")
+		{
+			this->feature_registration = new FeatureRegistration;
+			this->feature_registration->setNeighbours(feature_neighbours);
+			this->feature_registration->setMaximumIterations(plane_max_iterations);
+			this->feature_registration->setMaxCorrespondenceDistance(plane_max_correspondence);
+			// features are not cut to a height band, their target is the full (or non-ground) map
+			this->feature_registration->setInputTarget(this->map);
+			this->gn_registration.reset(this->feature_registration);
+		}
+		else if (this->registration != "icp")
+			ROS_ERROR("unknown registration '%s', using icp", this->registration.c_str());
+		if (this->gn_registration)
+		{
+			this->gn_registration->setPlanar(this->planar_registration);
+			GaussNewtonRegistration::Kernel kernel;
+			if (GaussNewtonRegistration::parseKernel(robust_kernel, kernel))
+				this->gn_registration->setRobustKernel(kernel);
+			else
+				ROS_ERROR("unknown robust_kernel '%s', using none", robust_kernel.c_str());
+		}
+		// only the chunked point-to-point ICP can stop at the budget, the others would always fall back to the prior
+		if (this->icp_time_budget > 0 && (this->gn_registration || this->anderson_depth > 0))
+		{
+			ROS_WARN("icp_time_budget needs the icp registration and anderson_depth 0, budget disabled");
+			this->icp_time_budget = 0;
+		}
+		// the baseline is only comparable to an Anderson run of the plain point-to-point ICP
+		if (this->benchmark_anderson && (this->anderson_depth <= 0 || this->icp_time_budget > 0 || this->gn_registration))
+		{
+			ROS_WARN("benchmark_anderson needs anderson_depth > 0, icp_time_budget 0 and the icp registration, benchmark disabled");
+			this->benchmark_anderson = false;
+		}
+
+		// the coarse alignment that places the scan in the occupancy is the pyramid, a single level if none is set
+		if (dynamic_filter)
+		{
+			this->map_occupancy.reset(new MapOccupancy(occupancy_resolution, occupancy_neighbours));
+			this->map_occupancy->setMap(*this->map);
+			ROS_INFO("dynamic filter: %zu occupied voxels of %.2f m", this->map_occupancy->voxelCount(), occupancy_resolution);
+			if (this->pyramid_leaf_sizes.empty())
+			{
+				this->pyramid_leaf_sizes.push_back(dynamic_coarse_leaf);
+				ROS_INFO("dynamic filter: no pyramid_leaf_sizes set, adding a coarse level of %.2f m to place the scan", dynamic_coarse_leaf);
+			}
+		}
+
+		// map levels are voxelized once, each keeps its own kd-tree
+		if (!this->pyramid_leaf_sizes.empty())
+		{
+			this->pyramid.build(this->registration_map, this->pyramid_leaf_sizes, pyramid_distance_factor, pyramid_max_iterations);
+			if (this->planar_registration)
+				this->pyramid.setPlanar();
+			ROS_INFO("coarse-to-fine registration with %zu levels", this->pyramid_leaf_sizes.size());
+		}
+
+		if (!this->use_filter || this->gn_registration)
+		{
+			sensor_msgs::PointCloud2 map_cloud;
+			pcl::toROSMsg(*this->map, map_cloud);
+			map_cloud.header.frame_id = "world";
+			this->pub_map.publish(map_cloud);
+		}
+
 		// std::cout << "Loaded "
 		// 		  << map->width * map->height
 		// 		  << " data points from nuscenes_map_downsample.pcd with the following fields: "
@@ -158,6 +514,14 @@ public:
 		outfile.open(result_path);
 		transformation_record.open(transformation_path);
 		outfile << "id,x,y,z,yaw,pitch,roll" << std::endl;
+		if (!stats_path.empty())
+		{
+			stats_record.open(stats_path);
+			stats_record << "id,iterations,converged,fitness";
+			if (this->benchmark_anderson)
+				stats_record << ",baseline_iterations,baseline_fitness";
+			stats_record << std::endl;
+		}
 	}
 
 	/**
@@ -200,20 +564,89 @@ public:
 	}
 
 	/**
-	 * @brief Down sampling pointCloud of lidar scan
+	 * @brief configure a point-to-point ICP with the tuned parameters
+	 *
+	 * @param icp registration to configure
+	 * @param scan source in car frame
+	 * @param target map or cropped map
+	 */
+	void setup_icp(MeteredICP<pcl::PointXYZI, pcl::PointXYZI> &icp, const pcl::PointCloud<pcl::PointXYZI>::Ptr &scan,
+				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &target)
+	{
+		icp.setInputSource(scan);
+		icp.setInputTarget(target);
+		icp.setMaximumIterations(1000);				 
+		icp.setTransformationEpsilon(1e-12);		 
+		icp.setMaxCorrespondenceDistance(0.75);		
+		icp.setEuclideanFitnessEpsilon(0.00075);		 
+		icp.setRANSACOutlierRejectionThreshold(0.05); 
+		if (this->planar_registration)
+			icp.setTransformationEstimation(pcl::registration::TransformationEstimation2D<pcl::PointXYZI, pcl::PointXYZI>::Ptr(
+				new pcl::registration::TransformationEstimation2D<pcl::PointXYZI, pcl::PointXYZI>));
+	}
+
+	/**
+	 * @brief Move every point of a sweep to the lidar pose at the scan stamp
+	 *
+	 * Point times come from a float "time" field when the driver provides one,
+	 * otherwise from the azimuth; the lidar poses over the sweep are interpolated
+	 * from the odometry buffer. The reference is the lidar at msg->header.stamp,
+	 * the end of the sweep with scan_stamp_at_end and its start otherwise, so the
+	 * registered pose always belongs to the stamp it is published with.
 	 *
 	 * @param msg ros topic of lidar scan
+	 * @param scan points of msg in lidar frame, reordered
+	 * @return false if the odometry does not cover the sweep, scan is left as it was
+	 */
+	bool deskew_scan(const sensor_msgs::PointCloud2::ConstPtr &msg, pcl::PointCloud<pcl::PointXYZI> &scan)
+	{
+		std::vector<float> sweep_fraction;
+		bool has_time = false;
+		for (const sensor_msgs::PointField &field : msg->fields)
+			if (field.name == "time" && field.datatype == sensor_msgs::PointField::FLOAT32)
+				has_time = true;
+		if (has_time)
+		{
+			std::vector<float> times;
+			times.reserve(scan.size());
+			for (sensor_msgs::PointCloud2ConstIterator<float> it(*msg, "time"); it != it.end(); ++it)
+				times.push_back(*it);
+			this->deskew.relativeTimes(times, this->scan_period, sweep_fraction);
+		}
+		else
+			this->deskew.azimuthTimes(scan, sweep_fraction);
+
+		double stamp = msg->header.stamp.toSec();
+		double start = stamp - (this->scan_stamp_at_end ? this->scan_period : 0.0);
+		// knots relative to the pose at the stamp, not at the sweep start
+		Eigen::Isometry3d reference;
+		if (!interpolatePose(this->odom_buffer, stamp, this->max_odom_extrapolation, reference))
+			return false;
+		Eigen::Isometry3d lidar = toIsometry(c2l_eigen_transform);
+		std::vector<Eigen::Isometry3f> knots(this->deskew.bins + 1);
+		for (int k = 0; k <= this->deskew.bins; k++)
+		{
+			Eigen::Isometry3d pose;
+			if (!interpolatePose(this->odom_buffer, start + this->scan_period * k / this->deskew.bins, this->max_odom_extrapolation, pose))
+				return false;
+			knots[k] = (lidar.inverse() * reference.inverse() * pose * lidar).cast<float>();
+		}
+		this->deskew.apply(scan, sweep_fraction, knots);
+		return true;
+	}
+
+	/**
+	 * @brief Down sampling pointCloud of lidar scan
+	 *
+	 * @param raw_scan lidar scan in lidar frame
 	 * @return pcl::PointCloud<pcl::PointXYZI>::Ptr pointer of PointCloud of lidar scan after downsampling
 	 */
-	pcl::PointCloud<pcl::PointXYZI>::Ptr down_sampling(const sensor_msgs::PointCloud2::ConstPtr &msg)
+	pcl::PointCloud<pcl::PointXYZI>::Ptr down_sampling(const pcl::PointCloud<pcl::PointXYZI>::Ptr &raw_scan)
 	{
 
-		pcl::PointCloud<pcl::PointXYZI>::Ptr raw_scan(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PointCloud<pcl::PointXYZI>::Ptr result_scan(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PCLPointCloud2::Ptr filtered_scan(new pcl::PCLPointCloud2());
 
-		// sensor_msgs -> PointCloud
-		pcl::fromROSMsg(*msg, *raw_scan);
 		// PointCloud -> PointCloud2
 		pcl::toPCLPointCloud2(*raw_scan, *filtered_scan);
 
@@ -222,8 +655,11 @@ public:
 		// 所以我們上面需要先將msg轉成PointCloud後 再轉乘PointCloud2,
 		pcl::VoxelGrid<pcl::PCLPointCloud2> voxel_filter;
 		voxel_filter.setInputCloud(filtered_scan);
-		voxel_filter.setFilterFieldName("z");
-		voxel_filter.setFilterLimits(-2.0, 10.5);
+		if (!this->use_ground_segmentation)
+		{
+			voxel_filter.setFilterFieldName("z");
+			voxel_filter.setFilterLimits(-2.0, 10.5);
+		}
 		voxel_filter.setLeafSize(0.1f, 0.1f, 0.6f);
 		voxel_filter.filter(*filtered_scan);
 
@@ -244,10 +680,37 @@ public:
 		pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_map(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PointCloud<pcl::PointXYZI> aligned_points;
 
+		// =============== Motion prior from odometry interpolated at scan stamp ===============
+		// previous ICP result moved by the exact odometry motion between the two scan stamps
+		Eigen::Isometry3d odom_pose;
+		bool odom_valid = this->interpolate_odom &&
+						  interpolatePose(this->odom_buffer, msg->header.stamp.toSec(), this->max_odom_extrapolation, odom_pose);
+		if (odom_valid && this->has_previous_odom)
+		{
+			Eigen::Isometry3d relative = this->previous_odom_pose.inverse() * odom_pose;
+			this->initial_guess = this->previous_result * relative.matrix().cast<float>();
+		}
+		else if (this->interpolate_odom)
+			ROS_WARN_THROTTLE(1.0, "odometry does not cover scan stamp %f, using last ICP result as initial guess", msg->header.stamp.toSec());
+
+		// =============== Constant velocity prediction on SE(3) ===============
+		// used alone without odometry, otherwise blended with the odometry prior
+		Eigen::Isometry3d predicted_pose;
+		if (this->use_motion_model && this->motion_predictor.predict(msg->header.stamp.toSec(), predicted_pose))
+		{
+			bool odom_prior = this->use_odom && (!this->interpolate_odom || (odom_valid && this->has_previous_odom));
+			if (odom_prior)
+				predicted_pose = interpolateSE3(toIsometry(this->initial_guess), predicted_pose, this->motion_blend_weight);
+			this->initial_guess = predicted_pose.matrix().cast<float>();
+		}
+
 		// =============== Passthrough ===============
-		if(this->use_filter){
+		// the z band is already in the registration map; the Gauss-Newton backends keep their search
+		// structure over the whole registration map, cropping x and y would rebuild it every scan
+		bool crop_map = this->use_filter && !this->gn_registration;
+		if(crop_map){
 			pcl::PassThrough<pcl::PointXYZI> filter;
-			filter.setInputCloud(this->map);
+			filter.setInputCloud(this->registration_map);
 			filter.setFilterFieldName("x");
 			filter.setFilterLimits(this->initial_guess(0, 3) - 100.0, this->initial_guess(0, 3) + 100.0);
 			filter.filter(*filtered_map);
@@ -256,46 +719,274 @@ public:
 			filter.setFilterFieldName("y");
 			filter.setFilterLimits(this->initial_guess(1, 3) - 100.0, this->initial_guess(1, 3) + 100.0);
 			filter.filter(*filtered_map);
-
-			filter.setInputCloud(filtered_map);
-			filter.setFilterFieldName("z");
-			filter.setFilterLimits(1, 8);
-			filter.filter(*filtered_map);
 		}
 
+		// =============== Deskew ===============
+		pcl::PointCloud<pcl::PointXYZI>::Ptr raw_scan(new pcl::PointCloud<pcl::PointXYZI>);
+		pcl::fromROSMsg(*msg, *raw_scan);
+		if (this->use_deskew && !deskew_scan(msg, *raw_scan))
+			ROS_WARN_THROTTLE(1.0, "odometry does not cover the sweep of scan %f, not deskewed", msg->header.stamp.toSec());
+
 		// =============== Down sampling lidar scan ===============
 		pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PointCloud<pcl::PointXYZI>::Ptr final_filtered_scan(new pcl::PointCloud<pcl::PointXYZI>);
-		filtered_scan = down_sampling(msg);
+		pcl::PointCloud<pcl::PointXYZI> edges, planars;
+		pcl::PointCloud<pcl::PointXYZI> ground_scan;
+		pcl::PointCloud<pcl::PointXYZINormal> image_scan;
+		if (this->feature_registration)
+		{
+			// rings are recovered from the elevation in the lidar frame, so features are taken before the car transform
+			this->feature_extractor.extract(*raw_scan, edges, planars);
+			transformPointCloud(edges, edges, c2l_eigen_transform);
+			transformPointCloud(planars, planars, c2l_eigen_transform);
+			// the map has no ground left, ground planars go to the vertical registration
+			if (this->use_ground_segmentation)
+			{
+				pcl::PointCloud<pcl::PointXYZI> planar_non_ground;
+				this->ground_segmentation.segment(planars, ground_scan, planar_non_ground);
+				planars.swap(planar_non_ground);
+			}
+			*filtered_scan = edges;
+			*filtered_scan += planars;
+		}
+		else if (this->use_range_image)
+		{
+			// range gate, isolated returns and downsampling on the image, normals from the image neighbours
+			this->range_image.project(*raw_scan);
+			this->range_image.removeOutliers();
+			this->range_image.extract(this->range_row_step, this->range_column_step, image_scan);
+			pcl::transformPointCloudWithNormals(image_scan, image_scan, c2l_eigen_transform);
+
+			if (this->use_ground_segmentation)
+			{
+				pcl::PointCloud<pcl::PointXYZINormal> image_ground, image_non_ground;
+				this->ground_segmentation.segment(image_scan, image_ground, image_non_ground);
+				pcl::copyPointCloud(image_ground, ground_scan);
+				image_scan.swap(image_non_ground);
+			}
+			else
+			{
+				pcl::PassThrough<pcl::PointXYZINormal> height_filter;
+				height_filter.setInputCloud(image_scan.makeShared());
+				height_filter.setFilterFieldName("z");
+				height_filter.setFilterLimits(1.0, 7.5);
+				height_filter.filter(image_scan);
+			}
+			pcl::copyPointCloud(image_scan, *filtered_scan);
+		}
+		else
+		{
+			filtered_scan = down_sampling(raw_scan);
 
-		// =============== transform scan to car ===============
-		// Eigen::Matrix4f trans = get_transform("nuscenes_lidar");
-		transformPointCloud(*filtered_scan, *filtered_scan, c2l_eigen_transform);
-		// std::cout << "Trans from tf:" << std::endl;
-		// std::cout << trans << std::endl;
-		// std::cout << "Trans from yaml:" << std::endl;
-		// std::cout << c2l_eigen_transform << std::endl;
+			// =============== transform scan to car ===============
+			// Eigen::Matrix4f trans = get_transform("nuscenes_lidar");
+			transformPointCloud(*filtered_scan, *filtered_scan, c2l_eigen_transform);
+			// std::cout << "Trans from tf:" << std::endl;
+			// std::cout << trans << std::endl;
+			// std::cout << "Trans from yaml:" << std::endl;
+			// std::cout << c2l_eigen_transform << std::endl;
 
-		pcl::VoxelGrid<pcl::PointXYZI> voxel_filter;
-		voxel_filter.setInputCloud(filtered_scan);
-		voxel_filter.setFilterFieldName("z");
-		voxel_filter.setFilterLimits(1.0, 7.5);
-		voxel_filter.setLeafSize(0.1f, 0.1f, 0.4f);
-		voxel_filter.filter(*filtered_scan);
+			if (this->scan_point_budget > 0)
+			{
+				pcl::PointCloud<pcl::PointXYZI>::Ptr budgeted(new pcl::PointCloud<pcl::PointXYZI>);
+				this->scan_budget.filter(filtered_scan, *budgeted);
+				filtered_scan = budgeted;
+			}
+			else
+			{
+				pcl::VoxelGrid<pcl::PointXYZI> voxel_filter;
+				voxel_filter.setInputCloud(filtered_scan);
+				if (!this->use_ground_segmentation)
+				{
+					voxel_filter.setFilterFieldName("z");
+					voxel_filter.setFilterLimits(1.0, 7.5);
+				}
+				voxel_filter.setLeafSize(0.1f, 0.1f, 0.4f);
+				voxel_filter.filter(*filtered_scan);
+			}
+
+			if (this->use_ground_segmentation)
+			{
+				pcl::PointCloud<pcl::PointXYZI>::Ptr non_ground(new pcl::PointCloud<pcl::PointXYZI>);
+				this->ground_segmentation.segment(*filtered_scan, ground_scan, *non_ground);
+				filtered_scan = non_ground;
+			}
+		}
+
+		// =============== coarse-to-fine alignment seeding the full ICP ===============
+		// the pyramid and the point-to-point ICP share the local origin, moved before either runs
+		bool recentered = false;
+		if (this->use_local_origin)
+		{
+			recentered = this->local_origin.update(this->initial_guess.block<3, 1>(0, 3).cast<double>());
+			if (recentered && !this->pyramid.empty())
+				this->pyramid.setOrigin(this->local_origin);
+		}
+		// the budget covers the pyramid too, an unconverged run falls back to the prior from before it
+		std::chrono::steady_clock::time_point registration_start = std::chrono::steady_clock::now();
+		Eigen::Matrix4f prior = this->initial_guess;
+		int pyramid_iterations = 0;
+		if (!this->pyramid.empty())
+		{
+			if (this->use_local_origin)
+			{
+				Eigen::Matrix4f pyramid_guess = this->local_origin.toLocal(this->initial_guess);
+				pyramid_iterations = this->pyramid.align(filtered_scan, pyramid_guess);
+				this->initial_guess = this->local_origin.toWorld(pyramid_guess).cast<float>();
+			}
+			else
+				pyramid_iterations = this->pyramid.align(filtered_scan, this->initial_guess);
+		}
+
+		// =============== drop points on objects missing from the static map ===============
+		if (this->map_occupancy)
+		{
+			int dropped = this->map_occupancy->filter(*filtered_scan, this->initial_guess, *filtered_scan);
+			if (this->use_range_image)
+				this->map_occupancy->filter(image_scan, this->initial_guess, image_scan);
+			if (this->feature_registration)
+			{
+				this->map_occupancy->filter(edges, this->initial_guess, edges);
+				this->map_occupancy->filter(planars, this->initial_guess, planars);
+			}
+			ROS_DEBUG("dynamic filter: %d of %zu points dropped", dropped, filtered_scan->size() + dropped);
+		}
+
+		// =============== information-aware sampling ===============
+		// the range image already has normals, the voxelized scan gets them from its neighbours
+		if (this->information_budget > 0 && !this->feature_registration)
+		{
+			std::vector<int> selected;
+			if (this->use_range_image)
+			{
+				pcl::PointCloud<pcl::PointXYZINormal> sampled;
+				informationSampling(image_scan, this->information_budget, selected);
+				pcl::copyPointCloud(image_scan, selected, sampled);
+				image_scan.swap(sampled);
+				pcl::copyPointCloud(image_scan, *filtered_scan);
+			}
+			else
+			{
+				NormalMap scan_normals;
+				estimateMapNormals<pcl::PointXYZI>(filtered_scan, this->information_normal_k, scan_normals);
+				informationSampling(scan_normals, this->information_budget, selected);
+				pcl::PointCloud<pcl::PointXYZI>::Ptr sampled(new pcl::PointCloud<pcl::PointXYZI>);
+				pcl::copyPointCloud(scan_normals, selected, *sampled);
+				filtered_scan = sampled;
+			}
+		}
 
 		// =============== start performing ICP ===============
-		pcl::IterativeClosestPoint<pcl::PointXYZI, pcl::PointXYZI> icp;
-		icp.setInputSource(filtered_scan);
-		if(this->use_filter)
-			icp.setInputTarget(filtered_map);
+		int icp_iterations;
+		bool icp_converged;
+		std::stringstream baseline_stats;
+		double icp_fitness;
+		Eigen::Matrix4f icp_result;
+		if (this->gn_registration)
+		{
+			if (this->local_map)
+			{
+				int changed = this->local_map->update(this->initial_guess.block<3, 1>(0, 3).cast<double>());
+				if (changed)
+					ROS_DEBUG("local map: %d columns changed, %zu voxels", changed, this->local_map->voxelCount());
+			}
+			if (this->feature_registration)
+				icp_converged = this->feature_registration->alignFeatures(edges, planars, this->initial_guess);
+			else if (this->vgicp_registration && this->use_range_image)
+				icp_converged = this->vgicp_registration->alignWithNormals(image_scan, this->initial_guess);
+			else
+				icp_converged = this->gn_registration->align(*filtered_scan, this->initial_guess);
+			icp_iterations = this->gn_registration->getIterations();
+			icp_fitness = this->gn_registration->getFitnessScore();
+			icp_result = this->gn_registration->getFinalTransformation();
+			pcl::transformPointCloud(*filtered_scan, aligned_points, icp_result);
+		}
 		else
-			icp.setInputTarget(this->map);
-		icp.setMaximumIterations(1000);				 
-		icp.setTransformationEpsilon(1e-12);		 
-		icp.setMaxCorrespondenceDistance(0.75);		
-		icp.setEuclideanFitnessEpsilon(0.00075);		 
-		icp.setRANSACOutlierRejectionThreshold(0.05); 
-		icp.align(aligned_points, this->initial_guess);
+		{
+			// target and guess around the local origin, the whole map is shifted only when the origin moves
+			pcl::PointCloud<pcl::PointXYZI>::Ptr icp_target = crop_map ? filtered_map : this->registration_map;
+			Eigen::Matrix4f icp_guess = this->initial_guess;
+			if (this->use_local_origin)
+			{
+				if (crop_map)
+				{
+					icp_target.reset(new pcl::PointCloud<pcl::PointXYZI>);
+					this->local_origin.toLocal(*filtered_map, *icp_target);
+				}
+				else
+				{
+					if (recentered)
+						this->local_origin.toLocal(*this->registration_map, *this->local_map_cloud);
+					icp_target = this->local_map_cloud;
+				}
+				icp_guess = this->local_origin.toLocal(this->initial_guess);
+			}
+
+			MeteredICP<pcl::PointXYZI, pcl::PointXYZI> icp;
+			setup_icp(icp, filtered_scan, icp_target);
+			if (this->icp_time_budget > 0)
+			{
+				double spent = std::chrono::duration<double>(std::chrono::steady_clock::now() - registration_start).count();
+				AnytimeResult budget = icp.alignWithBudget(aligned_points, icp_guess, std::max(this->icp_time_budget - spent, 0.0), this->icp_budget_chunk);
+				icp_iterations = budget.iterations;
+				icp_converged = budget.converged;
+				if (budget.budget_exhausted)
+					ROS_WARN_THROTTLE(1.0, "ICP budget of %.1f ms spent after %d iterations without convergence (%.1f ms in the pyramid)",
+									  this->icp_time_budget * 1000.0, budget.iterations, spent * 1000.0);
+			}
+			else if (this->anderson_depth > 0)
+			{
+				AnytimeResult accelerated = icp.alignAnderson(aligned_points, icp_guess, this->anderson_depth);
+				icp_iterations = accelerated.iterations;
+				icp_converged = accelerated.converged;
+			}
+			else
+			{
+				icp.align(aligned_points, icp_guess);
+				icp_iterations = icp.getIterations();
+				icp_converged = icp.hasConverged();
+			}
+			icp_fitness = icp.getFitnessScore();
+			icp_result = icp.getFinalTransformation();
+			if (this->use_local_origin)
+			{
+				icp_result = this->local_origin.toWorld(icp_result).cast<float>();
+				pcl::transformPointCloud(*filtered_scan, aligned_points, icp_result);
+			}
+
+			// same frame and prior through the plain ICP, only recorded
+			if (this->benchmark_anderson)
+			{
+				MeteredICP<pcl::PointXYZI, pcl::PointXYZI> baseline;
+				pcl::PointCloud<pcl::PointXYZI> baseline_points;
+				setup_icp(baseline, filtered_scan, icp_target);
+				baseline.align(baseline_points, icp_guess);
+				this->total_baseline_iterations += baseline.getIterations();
+				if (this->stats_record.is_open())
+					baseline_stats << "," << baseline.getIterations() << "," << baseline.getFitnessScore();
+			}
+		}
+		icp_iterations += pyramid_iterations;
+
+		// =============== z, roll, pitch from the ground ===============
+		if (this->ground_registration && !ground_scan.empty())
+		{
+			if (this->ground_registration->align(ground_scan, icp_result))
+			{
+				icp_result = this->ground_registration->getFinalTransformation();
+				pcl::transformPointCloud(*filtered_scan, aligned_points, icp_result);
+			}
+			icp_iterations += this->ground_registration->getIterations();
+		}
+
+		// an unconverged budgeted run keeps the motion prior instead of a half way result
+		if (icp_converged || this->icp_time_budget <= 0)
+			this->initial_guess = icp_result;
+		else
+		{
+			this->initial_guess = prior;
+			pcl::transformPointCloud(*filtered_scan, aligned_points, prior);
+		}
 
 		// publish transformed points and map
 		sensor_msgs::PointCloud2::Ptr out_msg(new sensor_msgs::PointCloud2);
@@ -304,19 +995,23 @@ public:
 		out_msg->header.frame_id = "world";
 		pub_lidar.publish(out_msg);
 
-		sensor_msgs::PointCloud2::Ptr map_cloud(new sensor_msgs::PointCloud2);
-		if(use_filter)
+		if(crop_map)
+		{
+			sensor_msgs::PointCloud2::Ptr map_cloud(new sensor_msgs::PointCloud2);
 			pcl::toROSMsg(*filtered_map, *map_cloud);
-		else
-			pcl::toROSMsg(*this->map, *map_cloud);
-
-		map_cloud->header.frame_id = "world";
-		this->pub_map.publish(*map_cloud);
+			map_cloud->header.frame_id = "world";
+			this->pub_map.publish(*map_cloud);
+		}
 
 		// =============== Get car pos using ICP result===============
 		// initial guess是map 看向 car的轉換
-		this->initial_guess = icp.getFinalTransformation();
 		Eigen::Matrix4f transformation = this->initial_guess;
+		this->previous_result = this->initial_guess;
+		this->previous_odom_pose = odom_pose;
+		this->has_previous_odom = odom_valid;
+		this->motion_predictor.addPose(msg->header.stamp.toSec(), toIsometry(this->initial_guess));
+		if (this->pose_output)
+			this->pose_output->correct(msg->header.stamp.toSec(), toIsometry(this->initial_guess));
 
 		tf2::Matrix3x3 m2c_trans_rotation;
 		m2c_trans_rotation.setValue(
@@ -332,7 +1027,11 @@ public:
 		double roll, pitch, yaw;
 		m2c_rotation_angle.getRPY(roll, pitch, yaw);
 
-		std::cout << "Now frame: " << this->frame_number << std::endl;
+		this->total_iterations += icp_iterations;
+		std::cout << "Now frame: " << this->frame_number << ", ICP iterations: " << icp_iterations
+				  << " (mean " << this->total_iterations / (double)(this->frame_number + 1) << ")" << std::endl;
+		if (this->stats_record.is_open())
+			stats_record << this->frame_number + 1 << "," << icp_iterations << "," << icp_converged << "," << icp_fitness << baseline_stats.str() << std::endl;
 		outfile << ++this->frame_number << "," << initial_guess(0, 3) << "," << initial_guess(1, 3) << "," << 0 << "," << yaw << "," << pitch << "," << roll << std::endl;
 		transformation_record << transformation << std::endl
 							  << std::endl
@@ -344,18 +1043,31 @@ public:
 			system("pkill roslaunch");
 		}
 
-		// 除以frequency ratio 算出在一frame的lidar point當中我們的odom是多少
-		// 觀察csv後發現單純的icp下點基本上沒有移動
-		// 我猜或許是因為定位的環境是沒有甚麼特徵的地方，所以icp基本不會移動，只好靠odom來幫我們修正了
-		initial_guess(0, 3) += this->diff_x / this->frequency_ratio;
-		initial_guess(1, 3) += this->diff_y / this->frequency_ratio;
-		initial_guess(2, 3) += this->diff_z / this->frequency_ratio;
+		// with interpolate_odom the prior is applied at the next scan, otherwise fall back to the hand tuned ratio
+		if (!this->interpolate_odom)
+		{
+			// motion of the last odometry step, read from the buffer without blocking the sensor thread
+			StampedState odom_now, odom_prev;
+			if (this->odom_buffer.getPair(0, odom_now, odom_prev))
+			{
+				this->diff_x = odom_now.x - odom_prev.x;
+				this->diff_y = odom_now.y - odom_prev.y;
+				this->diff_z = odom_now.z - odom_prev.z;
+			}
+
+			// 除以frequency ratio 算出在一frame的lidar point當中我們的odom是多少
+			// 觀察csv後發現單純的icp下點基本上沒有移動
+			// 我猜或許是因為定位的環境是沒有甚麼特徵的地方，所以icp基本不會移動，只好靠odom來幫我們修正了
+			initial_guess(0, 3) += this->diff_x / this->frequency_ratio;
+			initial_guess(1, 3) += this->diff_y / this->frequency_ratio;
+			initial_guess(2, 3) += this->diff_z / this->frequency_ratio;
+		}
 
-		if (icp.getFitnessScore() > this->previous_score || !icp.hasConverged())
+		if (icp_fitness > this->previous_score || !icp_converged)
 			this->frequency_ratio * this->fix_rate;
 		else
 			this->frequency_ratio / this->fix_rate;
-		this->previous_score = icp.getFitnessScore();
+		this->previous_score = icp_fitness;
 	}
 
 	/**
@@ -364,7 +1076,15 @@ public:
 	 */
 	~icp_localization()
 	{
+		if (this->pose_output)
+			this->pose_output->stop();
+		this->sensor_spinner.stop();
+		if (this->frame_number > 0)
+			ROS_INFO("mean ICP iterations per frame: %f", this->total_iterations / (double)this->frame_number);
+		if (this->benchmark_anderson && this->frame_number > 0)
+			ROS_INFO("mean plain ICP iterations per frame: %f", this->total_baseline_iterations / (double)this->frame_number);
 		this->outfile.close();
+		this->stats_record.close();
 	}
 
 	/**
@@ -414,18 +1134,22 @@ public:
 	}
 
 	/**
-	 * @brief
+	 * @brief store wheel odometry into the lock-free buffer, runs on the sensor queue
 	 *
 	 * @param msg a rostopic from wheel_odometry using nav_msgs::Odometry
 	 */
 	void odom_callback(const nav_msgs::Odometry::ConstPtr &msg){
 
-		this->diff_x = msg->pose.pose.position.x - this->odom_x;
-		this->diff_y = msg->pose.pose.position.y - this->odom_y;
-		this->diff_z = msg->pose.pose.position.z - this->odom_z;
-		this->odom_x = msg->pose.pose.position.x;
-		this->odom_y = msg->pose.pose.position.y;
-		this->odom_z = msg->pose.pose.position.z;
+		StampedState state;
+		state.stamp = msg->header.stamp.toSec();
+		state.x = msg->pose.pose.position.x;
+		state.y = msg->pose.pose.position.y;
+		state.z = msg->pose.pose.position.z;
+		state.qx = msg->pose.pose.orientation.x;
+		state.qy = msg->pose.pose.orientation.y;
+		state.qz = msg->pose.pose.orientation.z;
+		state.qw = msg->pose.pose.orientation.w;
+		this->odom_buffer.push(state);
 
 	}
 };
@@ -1,4 +1,6 @@
 #include "math.h"
+#include <mutex>
+#include <memory>
 #include <string>
 #include "stdio.h"
 #include <fstream>
@@ -22,9 +24,16 @@
 #include <pcl/filters/passthrough.h>
 #include <tf/transform_broadcaster.h>
 #include <tf2/LinearMath/Matrix3x3.h>
+#include <ros/callback_queue.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
 
+#include "state_buffer.h"
+#include "error_state_kf.h"
+#include "pose_interpolation.h"
+#include "transform_cache.h"
+#include "icp_covariance.h"
+
 class icp_localization
 {
 
@@ -38,21 +47,33 @@ private:
 	ros::Subscriber sub_odom;
 	ros::Publisher pub_lidar;
 	bool gps_ready, map_ready;
+	ros::Subscriber sub_imu;
 	ros::Subscriber sub_filter;
+	ros::Publisher pub_fused_pose;
 	ros::Publisher pub_set_pose;
 	ros::Publisher pub_car_pose;
 	ros::Subscriber sub_lidar_scan;
 	tf::TransformListener tf_listener;
 	tf::TransformBroadcaster tf_broadcaster;
 
+	// sensor callbacks run on their own queue so they never wait behind ICP
+	ros::NodeHandle sensor_nh;
+	ros::CallbackQueue sensor_queue;
+	ros::AsyncSpinner sensor_spinner;
+
+	// static extrinsics resolved once and invalidated on /tf_static
+	std::unique_ptr<TransformCache> tf_cache;
+
 	// =============== variables of transformation ===============
 	bool use_gps;
 	bool use_odom;
 	double odom_ratio;
 	double lidar_ratio;
 	double frequency_ratio;
-	double odom_x, odom_y, odom_z;
 	double diff_x, diff_y, diff_z;
+	StateBuffer<StampedState> odom_buffer;
+	StateBuffer<StampedState> filter_buffer;
+	double last_filter_stamp;
 	Eigen::Matrix4f initial_guess;
 	sensor_msgs::PointCloud2 Final_map;
 	geometry_msgs::Transform car2Lidar;
@@ -60,7 +81,31 @@ private:
 	sensor_msgs::PointCloud2 Final_cloud;
 	double init_x, init_y, init_z,init_yaw;
 	pcl::PointCloud<pcl::PointXYZI>::Ptr map;
-	double filtered_x, filtered_y, filtered_z;
+
+	// =============== in-process error-state Kalman filter ===============
+	// replaces the robot_localization round trip through /odometry/filtered
+	bool use_eskf;
+	bool use_imu;
+	std::mutex eskf_mutex;
+	ErrorStateKF eskf;
+	double icp_position_std;
+	double icp_rotation_std;
+	double odom_velocity_std;
+
+	// filter poses of the recent propagation steps, written under eskf_mutex. They exclude the
+	// ICP corrections (eskf_correction, map <- history), so two samples differ by the propagated motion
+	StateBuffer<StampedState> eskf_history;
+	Eigen::Isometry3d eskf_correction;
+	ros::Time eskf_stamp;
+	double max_history_extrapolation;
+
+	// covariance of the ICP pose from the registration Hessian
+	bool use_icp_covariance;
+	double degenerate_threshold;
+	double degenerate_variance;
+	double last_imu_stamp;
+	bool has_last_odom;
+	StampedState last_odom;
 
 	// =============== variables of output file ===============
 	std::ofstream outfile;
@@ -83,19 +128,22 @@ public:
 	 *
 	 * @param _nh ros node handler
 	 */
-	icp_localization(ros::NodeHandle _nh) : map(new pcl::PointCloud<pcl::PointXYZI>)
+	icp_localization(ros::NodeHandle _nh) : sensor_spinner(1, &sensor_queue), map(new pcl::PointCloud<pcl::PointXYZI>)
 	{
 
 		std::vector<float> trans, rot;
 		std::cout << "Initializing ICP...\n";
 		this->nh = _nh;
+		this->sensor_nh = _nh;
+		this->sensor_nh.setCallbackQueue(&this->sensor_queue);
+		this->tf_cache.reset(new TransformCache(this->sensor_nh, this->tf_listener));
 
 		// grasping ros parameters
 		_nh.param<bool>("use_gps", use_gps, true);
 		_nh.param<double>("init_x", init_x, 0.15);
 		_nh.param<double>("init_y", init_y, 0.15);
 		_nh.param<double>("init_z", init_z, 0.15);
-		_nh.param<bool>("use_odom", use_gps, true);
+		_nh.param<bool>("use_odom", use_odom, true);
 		_nh.param<double>("fix_rate", fix_rate, 1.0);
 		_nh.param<double>("init_yaw", init_yaw, 0.15);
 		_nh.param<int>("total_frame", total_frame, 1);
@@ -109,23 +157,44 @@ public:
 		_nh.param<std::vector<float>>("baselink2lidar_rot", rot, std::vector<float>());
 		_nh.param<std::vector<float>>("baselink2lidar_trans", trans, std::vector<float>());
 		_nh.param<std::string>("transformation_path", transformation_path, "transformation.txt");
+		_nh.param<bool>("use_eskf", use_eskf, false);
+		_nh.param<bool>("use_imu", use_imu, false);
+		_nh.param<double>("icp_position_std", icp_position_std, 0.1);
+		_nh.param<double>("icp_rotation_std", icp_rotation_std, 0.02);
+		_nh.param<double>("odom_velocity_std", odom_velocity_std, 0.2);
+		_nh.param<double>("max_history_extrapolation", max_history_extrapolation, 0.1);
+		_nh.param<bool>("use_icp_covariance", use_icp_covariance, true);
+		_nh.param<double>("degenerate_threshold", degenerate_threshold, 0.01);
+		_nh.param<double>("degenerate_variance", degenerate_variance, 10.0);
+
+		ErrorStateKF::Noise eskf_noise;
+		_nh.param<double>("imu_acc_noise", eskf_noise.acc, eskf_noise.acc);
+		_nh.param<double>("imu_gyro_noise", eskf_noise.gyro, eskf_noise.gyro);
+		_nh.param<double>("odom_trans_noise", eskf_noise.odom_trans, eskf_noise.odom_trans);
+		_nh.param<double>("odom_rot_noise", eskf_noise.odom_rot, eskf_noise.odom_rot);
+		this->eskf.setNoise(eskf_noise);
 
-		this->odom_x = 0;
-		this->odom_y = 0;
-		this->odom_z = 0;
 		this->diff_x = 0;
 		this->diff_y = 0;
 		this->diff_z = 0;
-		this->filtered_x = 0;
-		this->filtered_y = 0;
-		this->filtered_z = 0;
+		this->last_filter_stamp = 0;
+		this->last_imu_stamp = 0;
+		this->eskf_correction = Eigen::Isometry3d::Identity();
+		this->has_last_odom = false;
 		this->frame_number = 0;
 		this->previous_score = 0;
 		this->pub_map = nh.advertise<sensor_msgs::PointCloud2>("/map", 1);
 		this->pub_lidar = this->nh.advertise<sensor_msgs::PointCloud2>("/transformed_points", 1);
 		if(this->use_odom)
-			this->sub_odom = this->nh.subscribe("/wheel_odometry", 4000000, &icp_localization::odom_callback, this);
-		this->sub_filter = this->nh.subscribe("/odometry/filtered_wheel", 4000000, &icp_localization::filter_callback, this);
+			this->sub_odom = this->sensor_nh.subscribe("/wheel_odometry", 4000000, &icp_localization::odom_callback, this);
+		if(this->use_eskf)
+		{
+			if(this->use_imu)
+				this->sub_imu = this->sensor_nh.subscribe("/imu/data", 4000000, &icp_localization::imu_callback, this);
+			this->pub_fused_pose = this->nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("/fused_pose", 100);
+		}
+		else
+			this->sub_filter = this->sensor_nh.subscribe("/odometry/filtered_wheel", 4000000, &icp_localization::filter_callback, this);
 		this->sub_lidar_scan = this->nh.subscribe("/lidar_points", 4000000, &icp_localization::lidar_scanning, this);
 		pub_pose = this->nh.advertise<geometry_msgs::PoseStamped>("/lidar_pose", 1);
 		pub_car_pose = this->nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("/car_pose", 1);
@@ -178,6 +247,8 @@ public:
 		outfile.open(result_path);
 		transformation_record.open(transformation_path);
 		outfile << "id,x,y,z,yaw,pitch,roll" << std::endl;
+
+		this->sensor_spinner.start();
 	}
 
 	/**
@@ -288,6 +359,25 @@ public:
 	void lidar_scanning(const sensor_msgs::PointCloud2::ConstPtr &msg)
 	{
 
+		// take the EKF estimate as initial guess, the in-process filter at the scan stamp
+		StampedState filtered;
+		Eigen::Isometry3d filter_at_scan;
+		if (this->use_eskf)
+		{
+			std::lock_guard<std::mutex> lock(this->eskf_mutex);
+			if (interpolatePose(this->eskf_history, msg->header.stamp.toSec(), this->max_history_extrapolation, filter_at_scan))
+				this->initial_guess = (this->eskf_correction * filter_at_scan).matrix().cast<float>();
+			else if (this->eskf.isInitialized())
+				this->initial_guess = this->eskf.pose().matrix().cast<float>();
+		}
+		else if (this->filter_buffer.latest(filtered) && filtered.stamp > this->last_filter_stamp)
+		{
+			this->initial_guess(0, 3) = filtered.x;
+			this->initial_guess(1, 3) = filtered.y;
+			this->initial_guess(2, 3) = filtered.z;
+			this->last_filter_stamp = filtered.stamp;
+		}
+
 		pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_map(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PointCloud<pcl::PointXYZI> aligned_points;
 
@@ -407,14 +497,71 @@ public:
 		pose_car.pose.pose.orientation.y = transform.getRotation().getY();
 		pose_car.pose.pose.orientation.z = transform.getRotation().getZ();
 		pose_car.pose.pose.orientation.w = transform.getRotation().getW();
-		pose_car.pose.covariance = {10, 0, 0, 0, 0, 0,
-									0, 10, 0, 0, 0, 0,
-									0, 0, 10, 0, 0, 0,
-									0, 0, 0, 10, 0, 0,
-									0, 0, 0, 0, 10, 0,
-									0, 0, 0, 0, 0, 10};
+
+		// covariance from the Hessian at convergence, fixed diagonal if it can not be estimated.
+		// icp_cov is published in the map frame, filter_cov follows the residual of ErrorStateKF::updatePose
+		Matrix6d icp_cov = Matrix6d::Zero();
+		icp_cov.block<3, 3>(0, 0).diagonal().setConstant(this->icp_position_std * this->icp_position_std);
+		icp_cov.block<3, 3>(3, 3).diagonal().setConstant(this->icp_rotation_std * this->icp_rotation_std);
+		Matrix6d filter_cov = icp_cov;
+		RegistrationCovariance registration_cov;
+		if (this->use_icp_covariance &&
+			estimateRegistrationCovariance(*filtered_scan, icp.getFinalTransformation(), *icp.getSearchMethodTarget(), icp.getMaxCorrespondenceDistance(),
+										   this->degenerate_threshold, this->degenerate_variance, registration_cov))
+		{
+			icp_cov = registration_cov.covariance;
+			filter_cov = filterPoseCovariance(registration_cov.covariance_car,
+											  icp.getFinalTransformation().block<3, 3>(0, 0).cast<double>());
+			if (registration_cov.degenerate_directions > 0)
+				ROS_WARN_THROTTLE(1.0, "frame %d: %d degenerate direction(s), normalized hessian eigenvalues [%f %f %f %f %f %f]",
+						 this->frame_number, registration_cov.degenerate_directions,
+						 registration_cov.eigenvalues(0), registration_cov.eigenvalues(1), registration_cov.eigenvalues(2),
+						 registration_cov.eigenvalues(3), registration_cov.eigenvalues(4), registration_cov.eigenvalues(5));
+		}
+		for (int i = 0; i < 6; i++)
+			for (int j = 0; j < 6; j++)
+				pose_car.pose.covariance[i * 6 + j] = icp_cov(i, j);
 		pub_car_pose.publish(pose_car); // publish car pose
 
+		// correct the in-process filter with the ICP pose. The sensor thread kept propagating
+		// during ICP, so the measurement is carried to the filter time with the motion since the scan
+		if (this->use_eskf)
+		{
+			std::lock_guard<std::mutex> lock(this->eskf_mutex);
+			Eigen::Isometry3d measured = toIsometry(this->initial_guess);
+			Eigen::Isometry3d before = this->eskf.pose();
+			bool fuse = true;
+			if (!this->eskf.isInitialized())
+			{
+				// the first ICP pose resets the filter, the published stamp never moves backwards
+				if (msg->header.stamp > this->eskf_stamp)
+					this->eskf_stamp = msg->header.stamp;
+			}
+			else if (interpolatePose(this->eskf_history, msg->header.stamp.toSec(), this->max_history_extrapolation, filter_at_scan))
+				measured = measured * filter_at_scan.inverse() * this->eskf_correction.inverse() * before;
+			else
+			{
+				// scan stamp outside the filter history, the pose cannot be carried to the filter time
+				ROS_WARN_THROTTLE(1.0, "scan stamp %f is not covered by the filter history, ICP pose not fused", msg->header.stamp.toSec());
+				fuse = false;
+			}
+			if (fuse)
+			{
+				this->eskf.updatePose(measured, filter_cov);
+				this->eskf_correction = this->eskf.pose() * before.inverse() * this->eskf_correction;
+				publish_fused_pose(this->eskf_stamp);
+			}
+		}
+
+		// motion of the last odometry step, read from the buffer without blocking the sensor thread
+		StampedState odom_now, odom_prev;
+		if (this->odom_buffer.getPair(0, odom_now, odom_prev))
+		{
+			this->diff_x = odom_now.x - odom_prev.x;
+			this->diff_y = odom_now.y - odom_prev.y;
+			this->diff_z = odom_now.z - odom_prev.z;
+		}
+
 		// 除以frequency ratio 算出在一frame的lidar point當中我們的odom是多少
 		// 觀察csv後發現單純的icp下點基本上沒有移動
 		// 我猜或許是因為定位的環境是沒有甚麼特徵的地方，所以icp基本不會移動，只好靠odom來幫我們修正了
@@ -435,6 +582,7 @@ public:
 	 */
 	~icp_localization()
 	{
+		this->sensor_spinner.stop();
 		this->outfile.close();
 	}
 
@@ -485,25 +633,110 @@ public:
 	}
 
 	/**
-	 * @brief
+	 * @brief store wheel odometry into the lock-free buffer, runs on the sensor queue
 	 *
 	 * @param msg a rostopic from wheel_odometry using nav_msgs::Odometry
 	 */
 	void odom_callback(const nav_msgs::Odometry::ConstPtr &msg){
 
-		this->diff_x = msg->pose.pose.position.x - this->odom_x;
-		this->diff_y = msg->pose.pose.position.y - this->odom_y;
-		this->diff_z = msg->pose.pose.position.z - this->odom_z;
-		this->odom_x = msg->pose.pose.position.x;
-		this->odom_y = msg->pose.pose.position.y;
-		this->odom_z = msg->pose.pose.position.z;
+		StampedState state;
+		state.stamp = msg->header.stamp.toSec();
+		state.x = msg->pose.pose.position.x;
+		state.y = msg->pose.pose.position.y;
+		state.z = msg->pose.pose.position.z;
+		state.qx = msg->pose.pose.orientation.x;
+		state.qy = msg->pose.pose.orientation.y;
+		state.qz = msg->pose.pose.orientation.z;
+		state.qw = msg->pose.pose.orientation.w;
+		this->odom_buffer.push(state);
+
+		// wheel odometry drives the filter prediction, or corrects its velocity when the IMU predicts
+		if (this->use_eskf && this->has_last_odom)
+		{
+			double dt = state.stamp - this->last_odom.stamp;
+			Eigen::Isometry3d delta = toIsometry(this->last_odom).inverse() * toIsometry(state);
+
+			std::lock_guard<std::mutex> lock(this->eskf_mutex);
+			if (this->use_imu && dt > 0)
+				this->eskf.updateVelocity(delta.translation() / dt, Eigen::Matrix3d::Identity() * this->odom_velocity_std * this->odom_velocity_std);
+			else
+				this->eskf.predictRelative(delta, dt);
+			record_filter_state(msg->header.stamp);
+			publish_fused_pose(msg->header.stamp);
+		}
+		this->last_odom = state;
+		this->has_last_odom = true;
 
 	}
 
 	/**
-	 * @brief
+	 * @brief propagate the error-state filter with IMU, runs on the sensor queue
 	 *
-	 * @param msg a rostopic from wheel_odometry using nav_msgs::Odometry
+	 * @param msg a rostopic of imu data using sensor_msgs::Imu
+	 */
+	void imu_callback(const sensor_msgs::Imu::ConstPtr &msg){
+
+		double stamp = msg->header.stamp.toSec();
+		if (this->last_imu_stamp > 0)
+		{
+			Eigen::Vector3d acc(msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z);
+			Eigen::Vector3d gyro(msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z);
+
+			std::lock_guard<std::mutex> lock(this->eskf_mutex);
+			this->eskf.predictImu(acc, gyro, stamp - this->last_imu_stamp);
+			record_filter_state(msg->header.stamp);
+			publish_fused_pose(msg->header.stamp);
+		}
+		this->last_imu_stamp = stamp;
+	}
+
+	/**
+	 * @brief append the propagated filter pose to the history, caller holds eskf_mutex
+	 *
+	 * @param stamp time of the prediction
+	 */
+	void record_filter_state(const ros::Time &stamp){
+
+		if (!this->eskf.isInitialized())
+			return;
+		this->eskf_stamp = stamp;
+		this->eskf_history.push(toState(this->eskf_correction.inverse() * this->eskf.pose(), stamp.toSec()));
+	}
+
+	/**
+	 * @brief publish the fused pose of the error-state filter, caller holds eskf_mutex
+	 *
+	 * @param stamp time of the last prediction or correction
+	 */
+	void publish_fused_pose(const ros::Time &stamp){
+
+		if (!this->eskf.isInitialized())
+			return;
+
+		Eigen::Isometry3d pose = this->eskf.pose();
+		Eigen::Quaterniond q(pose.linear());
+		Matrix6d cov = this->eskf.poseCovariance();
+
+		geometry_msgs::PoseWithCovarianceStamped fused;
+		fused.header.stamp = stamp;
+		fused.header.frame_id = "world";
+		fused.pose.pose.position.x = pose.translation().x();
+		fused.pose.pose.position.y = pose.translation().y();
+		fused.pose.pose.position.z = pose.translation().z();
+		fused.pose.pose.orientation.x = q.x();
+		fused.pose.pose.orientation.y = q.y();
+		fused.pose.pose.orientation.z = q.z();
+		fused.pose.pose.orientation.w = q.w();
+		for (int i = 0; i < 6; i++)
+			for (int j = 0; j < 6; j++)
+				fused.pose.covariance[i * 6 + j] = cov(i, j);
+		this->pub_fused_pose.publish(fused);
+	}
+
+	/**
+	 * @brief convert the EKF estimate into map frame and store it for the lidar stage, runs on the sensor queue
+	 *
+	 * @param msg a rostopic from robot_localization using nav_msgs::Odometry
 	 */
 	void filter_callback(const nav_msgs::Odometry::ConstPtr &msg){
 
@@ -521,12 +754,26 @@ public:
 		isometry.translation() = Eigen::Vector3d(msg->pose.pose.position.x, msg->pose.pose.position.y, msg->pose.pose.position.z);
 		EKFeigen = isometry.matrix().cast<float>();
 
-		// Eigen::Matrix4f EKFmatrix4f = EKFeigen * transform_c2l_4f; // (Affine3f) * (Matrix4f)
-		Eigen::Matrix4f EKFmatrix4f = EKFeigen * get_transform("origin", "car").inverse() * get_transform("world", "origin").inverse(); // (Affine3f) * (Matrix4f)
+		// world <- origin <- car is static, composed once by the cache instead of two blocking lookups per message
+		Eigen::Isometry3d world2car;
+		if (!this->tf_cache->lookupChain({"world", "origin", "car"}, world2car))
+			return;
 
-		this->initial_guess(0,3) = (EKFmatrix4f.inverse())(0,3);
-		this->initial_guess(1,3) = (EKFmatrix4f.inverse())(1,3);
-		this->initial_guess(2,3) = (EKFmatrix4f.inverse())(2,3);
+		// Eigen::Matrix4f EKFmatrix4f = EKFeigen * transform_c2l_4f; // (Affine3f) * (Matrix4f)
+		Eigen::Matrix4f EKFmatrix4f = EKFeigen * world2car.inverse().matrix().cast<float>(); // (Affine3f) * (Matrix4f)
+
+		Eigen::Matrix4f EKFinverse = EKFmatrix4f.inverse();
+		Eigen::Quaternionf EKFrotation(Eigen::Matrix3f(EKFinverse.block<3, 3>(0, 0)));
+		StampedState state;
+		state.stamp = msg->header.stamp.toSec();
+		state.x = EKFinverse(0, 3);
+		state.y = EKFinverse(1, 3);
+		state.z = EKFinverse(2, 3);
+		state.qx = EKFrotation.x();
+		state.qy = EKFrotation.y();
+		state.qz = EKFrotation.z();
+		state.qw = EKFrotation.w();
+		this->filter_buffer.push(state);
 
 		// std::cout << "Init guess by EKF\n";
 		// std::cout << EKFmatrix4f.inverse() << std::endl;
@@ -0,0 +1,183 @@
+#ifndef ICP_REGISTRATION_H
+#define ICP_REGISTRATION_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <pcl/common/transforms.h>
+#include <pcl/registration/icp.h>
+
+#include "anderson_acceleration.h"
+
+/**
+ * @brief Outcome of a time budgeted registration
+ *
+ */
+struct AnytimeResult
+{
+    int iterations;
+    bool converged;
+    bool budget_exhausted;
+    double elapsed; // seconds
+};
+
+/**
+ * @brief pcl::IterativeClosestPoint exposing the iterations used by the last align()
+ *
+ */
+template <typename PointSource, typename PointTarget>
+class MeteredICP : public pcl::IterativeClosestPoint<PointSource, PointTarget>
+{
+    typedef pcl::registration::DefaultConvergenceCriteria<float> Criteria;
+
+public:
+    int getIterations() const { return this->nr_iterations_; }
+
+    /**
+     * @brief whether the last align() stopped on a convergence criterion
+     *
+     * hasConverged() is also true when align() merely reached the iteration cap,
+     * this excludes the cap and the runs that lost their correspondences.
+     */
+    bool reachedCriterion() const
+    {
+        if (!this->converged_)
+            return false;
+        typename Criteria::ConvergenceState state = this->convergence_criteria_->getConvergenceState();
+        return state != Criteria::CONVERGENCE_CRITERIA_NOT_CONVERGED &&
+               state != Criteria::CONVERGENCE_CRITERIA_ITERATIONS &&
+               state != Criteria::CONVERGENCE_CRITERIA_FAILURE_AFTER_MAX_ITERATIONS &&
+               state != Criteria::CONVERGENCE_CRITERIA_NO_CORRESPONDENCES;
+    }
+
+    /**
+     * @brief anytime align: iterate in chunks until converged or the wall-clock budget is spent
+     *
+     * The best transformation so far is always available through
+     * getFinalTransformation(). The maximum iterations set on the object stay the
+     * overall cap.
+     *
+     * @param output source aligned with the final transformation
+     * @param guess initial transformation
+     * @param budget wall-clock budget in seconds
+     * @param chunk iterations run between two budget checks
+     */
+    AnytimeResult alignWithBudget(pcl::PointCloud<PointSource> &output, const Eigen::Matrix4f &guess, double budget, int chunk = 5)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        int max_iterations = this->max_iterations_;
+        Eigen::Matrix4f current = guess;
+        AnytimeResult result = {0, false, false, 0};
+
+        this->convergence_criteria_->setFailureAfterMaximumIterations(true);
+        while (result.iterations < max_iterations)
+        {
+            this->setMaximumIterations(std::min(chunk, max_iterations - result.iterations));
+            this->align(output, current);
+            result.iterations += this->nr_iterations_;
+            current = this->final_transformation_;
+
+            typename Criteria::ConvergenceState state = this->convergence_criteria_->getConvergenceState();
+            if (state != Criteria::CONVERGENCE_CRITERIA_FAILURE_AFTER_MAX_ITERATIONS)
+            {
+                result.converged = state != Criteria::CONVERGENCE_CRITERIA_NO_CORRESPONDENCES &&
+                                   state != Criteria::CONVERGENCE_CRITERIA_NOT_CONVERGED;
+                break;
+            }
+
+            result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            if (result.elapsed >= budget)
+            {
+                result.budget_exhausted = true;
+                break;
+            }
+        }
+
+        this->convergence_criteria_->setFailureAfterMaximumIterations(false);
+        this->setMaximumIterations(max_iterations);
+        this->nr_iterations_ = result.iterations;
+        result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        return result;
+    }
+
+    /**
+     * @brief align with Anderson acceleration of the ICP fixed point iteration
+     *
+     * Every iteration is one plain ICP step G(x) on the twist x of the pose
+     * relative to the guess; Anderson extrapolates the next x from the last
+     * depth steps. The mean squared correspondence distance at an accelerated
+     * iterate is compared with the one of its predecessor, and a worse one is
+     * replaced by the plain step (safeguard). Stops on the same transformation
+     * and relative fitness epsilons as align().
+     *
+     * @param output source aligned with the final transformation
+     * @param guess initial transformation
+     * @param depth history of the acceleration
+     */
+    AnytimeResult alignAnderson(pcl::PointCloud<PointSource> &output, const Eigen::Matrix4f &guess, int depth = 5)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        int max_iterations = this->max_iterations_;
+        AnytimeResult result = {0, false, false, 0};
+        Eigen::Isometry3d base = toIsometry(guess);
+        AndersonAcceleration anderson(depth);
+
+        Vector6d x = Vector6d::Zero();
+        Vector6d plain = Vector6d::Zero();
+        double previous_energy = std::numeric_limits<double>::max();
+        bool accelerated = false;
+
+        this->setMaximumIterations(1);
+        while (result.iterations < max_iterations)
+        {
+            this->align(output, (base * expSE3(x)).matrix().cast<float>());
+            result.iterations++;
+            if (this->correspondences_->size() < 3)
+                break;
+
+            // mean squared distance of the correspondences at x
+            double energy = 0;
+            for (const pcl::Correspondence &correspondence : *this->correspondences_)
+                energy += correspondence.distance;
+            energy /= this->correspondences_->size();
+
+            if (accelerated && energy > previous_energy)
+            {
+                x = plain;
+                anderson.reset();
+                accelerated = false;
+                continue;
+            }
+
+            Vector6d g = logSE3(base.inverse() * toIsometry(this->final_transformation_));
+            Vector6d step = g - x;
+            bool small_step = step.head<3>().squaredNorm() <= this->transformation_epsilon_ && std::cos(step.tail<3>().norm()) >= 0.99999;
+            bool stalled = std::abs(previous_energy - energy) <= this->euclidean_fitness_epsilon_ * previous_energy;
+            plain = g;
+            previous_energy = energy;
+            if (small_step || stalled)
+            {
+                result.converged = true;
+                break;
+            }
+
+            x = anderson.compute(x, g);
+            accelerated = true;
+        }
+
+        this->setMaximumIterations(max_iterations);
+        this->final_transformation_ = (base * expSE3(plain)).matrix().cast<float>();
+        this->converged_ = result.converged;
+        this->nr_iterations_ = result.iterations;
+        pcl::transformPointCloud(*this->input_, output, this->final_transformation_);
+        result.elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        return result;
+    }
+};
+
+#endif // ICP_REGISTRATION_H
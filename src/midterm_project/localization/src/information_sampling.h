@@ -0,0 +1,95 @@
+#ifndef INFORMATION_SAMPLING_H
+#define INFORMATION_SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+
+#include "se3_utils.h"
+
+/**
+ * @brief Information-aware selection of scan points with normals.
+ *
+ * A point constrains the pose along v = [n, p x n], the row of its
+ * point-to-plane Jacobian. Points are chosen greedily to maximize
+ * log det(S0 + sum v v^T) of the selected set (D-optimal design): the gain of a
+ * point is log(1 + v^T S^-1 v), large only while it adds information along a
+ * direction the selection still lacks. Ground and facade points that all pin
+ * the same directions stop being picked once those are covered, while the few
+ * points that fix heading or the along-road position are kept. S0 is the mean
+ * information of priorPoints average points, which keeps the first picks from
+ * chasing noise; with S0 proportional to the full information the result does
+ * not depend on units or the origin. The objective is submodular, so a lazy
+ * greedy over a max-heap only re-evaluates a few candidates per pick.
+ *
+ * @param cloud points with normals, points with a NaN normal are never selected
+ * @param budget number of points to keep
+ * @param selected indices of the kept points, all valid points if there are fewer than the budget
+ * @param prior_points weight of the prior in average points
+ */
+template <typename PointT>
+void informationSampling(const pcl::PointCloud<PointT> &cloud, int budget, std::vector<int> &selected, double prior_points = 6.0)
+{
+    selected.clear();
+    std::vector<int> valid;
+    valid.reserve(cloud.size());
+    for (size_t i = 0; i < cloud.size(); i++)
+    {
+        const PointT &p = cloud.points[i];
+        if (std::isfinite(p.normal_x) && std::isfinite(p.normal_y) && std::isfinite(p.normal_z))
+            valid.push_back(int(i));
+    }
+    if ((int)valid.size() <= budget)
+    {
+        selected = valid;
+        return;
+    }
+
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d>> constraints(valid.size());
+    Matrix6d information = Matrix6d::Zero();
+    for (size_t k = 0; k < valid.size(); k++)
+    {
+        const PointT &p = cloud.points[valid[k]];
+        Eigen::Vector3d n(p.normal_x, p.normal_y, p.normal_z);
+        constraints[k] << n, Eigen::Vector3d(p.x, p.y, p.z).cross(n);
+        information += constraints[k] * constraints[k].transpose();
+    }
+    Matrix6d selected_information = information * (prior_points / valid.size()) + 1e-9 * Matrix6d::Identity();
+    Matrix6d inverse = selected_information.inverse();
+
+    // (gain upper bound, candidate); gains only shrink as the selection grows
+    std::vector<std::pair<double, int>> heap(valid.size());
+    for (size_t k = 0; k < valid.size(); k++)
+        heap[k] = std::make_pair(constraints[k].dot(inverse * constraints[k]), int(k));
+    std::make_heap(heap.begin(), heap.end());
+
+    selected.reserve(budget);
+    while ((int)selected.size() < budget && !heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end());
+        std::pair<double, int> top = heap.back();
+        heap.pop_back();
+        const Vector6d &v = constraints[top.second];
+        Vector6d Sv = inverse * v;
+        double gain = v.dot(Sv);
+        if (!heap.empty() && gain < heap.front().first)
+        {
+            // stale bound, put it back with the current gain
+            heap.push_back(std::make_pair(gain, top.second));
+            std::push_heap(heap.begin(), heap.end());
+            continue;
+        }
+        selected.push_back(valid[top.second]);
+        // Sherman-Morrison update of S^-1 for S + v v^T
+        inverse -= Sv * Sv.transpose() / (1.0 + gain);
+    }
+    std::sort(selected.begin(), selected.end());
+}
+
+#endif // INFORMATION_SAMPLING_H
@@ -0,0 +1,31 @@
+#ifndef LIDAR_RINGS_H
+#define LIDAR_RINGS_H
+
+#include <cmath>
+
+/**
+ * @brief Beam layout of a spinning multi-beam lidar.
+ *
+ * The scans arrive as unorganized PointXYZI, so the ring of a point is
+ * recovered from its elevation angle.
+ */
+struct LidarRings
+{
+    int rings = 32;
+    double minElevation = -30.67; // degrees, lowest beam
+    double maxElevation = 10.67;  // degrees, highest beam
+
+    /**
+     * @brief ring index of a point, -1 outside the vertical field of view
+     *
+     */
+    template <typename PointT>
+    int ring(const PointT &point) const
+    {
+        double elevation = std::atan2(point.z, std::sqrt(point.x * point.x + point.y * point.y)) * 180.0 / M_PI;
+        int index = int(std::round((elevation - minElevation) / (maxElevation - minElevation) * (rings - 1)));
+        return index >= 0 && index < rings ? index : -1;
+    }
+};
+
+#endif // LIDAR_RINGS_H
@@ -0,0 +1,72 @@
+#ifndef LOCAL_ORIGIN_H
+#define LOCAL_ORIGIN_H
+
+#include <cmath>
+
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+/**
+ * @brief Moving local origin for float registration.
+ *
+ * Map coordinates are hundreds to thousands of metres, where a float keeps
+ * about 0.1 mm and squared distances far less. Registration inputs are
+ * re-expressed around an origin near the vehicle (subtracted in double), and
+ * only the result goes back to world coordinates. The origin moves in whole
+ * metres once the vehicle is farther than the recenter distance, so clouds
+ * shifted once stay valid in between.
+ */
+class LocalOrigin
+{
+    Eigen::Vector3d origin;
+    double recenterDistance;
+    bool valid;
+
+public:
+    explicit LocalOrigin(double recenter_distance = 50.0)
+        : origin(Eigen::Vector3d::Zero()), recenterDistance(recenter_distance), valid(false) {}
+
+    const Eigen::Vector3d &get() const { return origin; }
+
+    /**
+     * @brief move the origin if the vehicle is too far from it
+     *
+     * @return true if the origin changed, clouds already shifted must be shifted again
+     */
+    bool update(const Eigen::Vector3d &position)
+    {
+        if (valid && (position - origin).norm() <= recenterDistance)
+            return false;
+        origin = Eigen::Vector3d(std::round(position.x()), std::round(position.y()), std::round(position.z()));
+        valid = true;
+        return true;
+    }
+
+    template <typename PointT>
+    void toLocal(const pcl::PointCloud<PointT> &world, pcl::PointCloud<PointT> &local) const
+    {
+        local = world;
+        for (PointT &point : local.points)
+        {
+            point.x = float(double(point.x) - origin.x());
+            point.y = float(double(point.y) - origin.y());
+            point.z = float(double(point.z) - origin.z());
+        }
+    }
+
+    Eigen::Matrix4f toLocal(const Eigen::Matrix4f &world) const
+    {
+        Eigen::Matrix4f local = world;
+        local.block<3, 1>(0, 3) = (world.block<3, 1>(0, 3).cast<double>() - origin).cast<float>();
+        return local;
+    }
+
+    Eigen::Matrix4d toWorld(const Eigen::Matrix4f &local) const
+    {
+        Eigen::Matrix4d world = local.cast<double>();
+        world.block<3, 1>(0, 3) += origin;
+        return world;
+    }
+};
+
+#endif // LOCAL_ORIGIN_H
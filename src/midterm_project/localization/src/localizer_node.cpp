@@ -17,6 +17,8 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl_ros/transforms.h>
 
+#include "startup_gate.h"
+
 class Localizer
 {
 
@@ -31,7 +33,8 @@ private:
 
     pcl::PointCloud<pcl::PointXYZI>::Ptr map_points;
     pcl::PointXYZ gps_point;
-    bool gps_ready = false, map_ready = false, initialied = false;
+    bool initialied = false;
+    StartupGate<sensor_msgs::PointCloud2::ConstPtr> startup;
     Eigen::Matrix4f init_guess;
     int cnt = 0;
 
@@ -59,6 +62,14 @@ public:
         _nh.param<std::string>("mapFrame", mapFrame, "world");
         _nh.param<std::string>("lidarFrame", lidarFrame, "nuscenes_lidar");
 
+        // scans arriving before map and gps are buffered, "latest" keeps only the newest one
+        int init_buffer_size;
+        std::string init_scan_policy;
+        _nh.param<int>("init_buffer_size", init_buffer_size, 10);
+        _nh.param<std::string>("init_scan_policy", init_scan_policy, "latest");
+        startup.setCapacity(init_buffer_size);
+        startup.setPolicy(init_scan_policy);
+
         ROS_INFO("saving results to %s", result_save_path.c_str());
         outfile.open(result_save_path);
         outfile << "id,x,y,z,yaw,pitch,roll" << std::endl;
@@ -103,7 +114,18 @@ public:
     {
         // ROS_INFO("Got map message");
         pcl::fromROSMsg(*msg, *map_points);
-        map_ready = true;
+        startup.setMapReady();
+        process_pending_scans();
+    }
+
+    /**
+     * @brief process scans buffered while waiting for map and gps
+     *
+     */
+    void process_pending_scans()
+    {
+        for (const auto &scan : startup.release())
+            process_scan(scan);
     }
 
     /**
@@ -112,23 +134,31 @@ public:
      * @param msg a rostopic of lidar pointCloud
      */
     void pc_callback(const sensor_msgs::PointCloud2::ConstPtr &msg)
+    {
+        // 確保map跟gps都收到了, 還沒收到的話先把scan存起來
+        if (!startup.admit(msg))
+        {
+            if (startup.getState() == StartupGate<sensor_msgs::PointCloud2::ConstPtr>::WAITING_MAP)
+                ROS_WARN_THROTTLE(1.0, "waiting for map data ...");
+            else if (startup.getState() == StartupGate<sensor_msgs::PointCloud2::ConstPtr>::WAITING_GPS)
+                ROS_WARN_THROTTLE(1.0, "waiting for gps data ...");
+            return;
+        }
+        process_scan(msg);
+    }
+
+    /**
+     * @brief align one lidar scan to the map and publish the result
+     *
+     * @param msg a rostopic of lidar pointCloud
+     */
+    void process_scan(const sensor_msgs::PointCloud2::ConstPtr &msg)
     {
 
         // ROS_INFO("Got lidar message");
         pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>);
         Eigen::Matrix4f result;
 
-        // 確保map跟gps都收到了
-        while (!(gps_ready & map_ready))
-        {   
-            if(gps_ready)
-                ROS_WARN("waiting for map data ...");
-            if(map_ready)
-                ROS_WARN("waiting for gps data ...");
-            ros::Duration(0.05).sleep();
-            ros::spinOnce();
-        }
-
         // 將lidar pointCloud 轉存成pcl的variable
         pcl::fromROSMsg(*msg, *scan_ptr);
         // ROS_INFO("point size: %d", scan_ptr->width);
@@ -165,6 +195,7 @@ public:
         pose.pose.orientation.z = transform.getRotation().getZ();
         pose.pose.orientation.w = transform.getRotation().getW();
         pub_pose.publish(pose);
+        startup.markPose();
 
         Eigen::Affine3d transform_c2l, transform_m2l;
         // transform from map to lidar
@@ -213,7 +244,8 @@ public:
             br.sendTransform(tf::StampedTransform(transform, msg->header.stamp, "world", "nuscenes_lidar"));
         }
 
-        gps_ready = true;
+        startup.setGpsReady();
+        process_pending_scans();
         return;
     }
 
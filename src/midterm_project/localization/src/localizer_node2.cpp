@@ -25,6 +25,8 @@
 #include <tf2/LinearMath/Matrix3x3.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include "startup_gate.h"
+
 class icp_localization
 {
 
@@ -35,7 +37,7 @@ private:
 	ros::Subscriber sub_gps;
 	ros::Subscriber sub_odom;
 	ros::Publisher pub_lidar;
-	bool gps_ready, map_ready;
+	StartupGate<sensor_msgs::PointCloud2::ConstPtr> startup;
 	ros::Subscriber sub_lidar_scan;
 	tf::TransformListener tf_listener;
 	tf::TransformBroadcaster tf_broadcaster;
@@ -81,8 +83,6 @@ public:
 		this->diff_y = 0;
 		this->diff_z = 0;
 		this->frame_number = 0;
-		this->gps_ready = false;
-		this->map_ready = false;
 		std::vector<float> trans, rot;
 		this->pub_lidar = this->nh.advertise<sensor_msgs::PointCloud2>("/transformed_points", 1);
 		this->sub_map = this->nh.subscribe("/map", 4000000, &icp_localization::map_callback, this);
@@ -100,6 +100,14 @@ public:
 		_nh.param<std::vector<float>>("baselink2lidar_trans", trans, std::vector<float>());
 		_nh.param<std::string>("transformation_path", transformation_path, "transformation.txt");
 
+		// scans arriving before map and gps are buffered, "latest" keeps only the newest one
+		int init_buffer_size;
+		std::string init_scan_policy;
+		_nh.param<int>("init_buffer_size", init_buffer_size, 10);
+		_nh.param<std::string>("init_scan_policy", init_scan_policy, "latest");
+		this->startup.setCapacity(init_buffer_size);
+		this->startup.setPolicy(init_scan_policy);
+
 		// 把itri.yaml中的transform link存下來
 		if (trans.size() != 3 | rot.size() != 4)
 			ROS_ERROR("transform not set properly");
@@ -138,7 +146,7 @@ public:
 		Eigen::Matrix4f initial_guess;
 		geometry_msgs::PointStampedConstPtr gps_point;
 		gps_point = ros::topic::waitForMessage<geometry_msgs::PointStamped>("/gps", this->nh);
-		this->gps_ready = true;
+		this->startup.setGpsReady();
 		std::cout << "Get GPS.\n";
 
 		double yaw = 0;
@@ -193,15 +201,23 @@ public:
 	void lidar_scanning(const sensor_msgs::PointCloud2::ConstPtr &msg)
 	{
 
-		while (!(gps_ready & map_ready))
+		// map還沒收到前先把scan存起來, 等map到了再處理
+		if (!this->startup.admit(msg))
 		{
-			// if (gps_ready)
-			// 	ROS_WARN("waiting for map data ...");
-			// if (map_ready)
-			// 	ROS_WARN("waiting for gps data ...");
-			ros::Duration(0.05).sleep();
-			ros::spinOnce();
+			ROS_WARN_THROTTLE(1.0, "waiting for map data ...");
+			return;
 		}
+		process_scan(msg);
+	}
+
+	/**
+	 * @brief perform icp on one lidar scan
+	 *
+	 * @param msg ros topic of lidar scan
+	 */
+	void process_scan(const sensor_msgs::PointCloud2::ConstPtr &msg)
+	{
+
 		pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_map(new pcl::PointCloud<pcl::PointXYZI>);
 		pcl::PointCloud<pcl::PointXYZI> aligned_points;
 
@@ -260,6 +276,7 @@ public:
 		out_msg->header = msg->header;
 		out_msg->header.frame_id = "world";
 		pub_lidar.publish(out_msg);
+		this->startup.markPose();
 
 
 		// =============== Get car pos using ICP result===============
@@ -357,7 +374,9 @@ public:
 		// ROS_INFO("Get map");
 		pcl::fromROSMsg(*msg, *map);
 
-		map_ready = true;
+		this->startup.setMapReady();
+		for (const auto &scan : this->startup.release())
+			process_scan(scan);
 	}
 
 	/**
@@ -0,0 +1,78 @@
+#ifndef MAP_OCCUPANCY_H
+#define MAP_OCCUPANCY_H
+
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+
+#include "voxel_hash.h"
+
+/**
+ * @brief Voxel occupancy of the static map, to drop scan points on objects the map does not have.
+ *
+ * A scan point placed by a coarse alignment is static if its voxel or one of
+ * the neighbouring voxels holds map points; the neighbourhood absorbs the
+ * error of the coarse pose. Parked and moving vehicles, pedestrians and other
+ * returns in free space are removed before the final registration, so they
+ * cannot form correspondences.
+ */
+class MapOccupancy
+{
+    std::unordered_set<Eigen::Vector3i, VoxelKeyHash> occupied;
+    double resolution;
+    std::vector<Eigen::Vector3i> offsets;
+
+public:
+    /**
+     * @param voxel_size edge of an occupancy voxel
+     * @param neighbours voxels checked around a point: 1, 7 or 27
+     */
+    explicit MapOccupancy(double voxel_size = 0.5, int neighbours = 27)
+        : resolution(voxel_size), offsets(voxelNeighbourOffsets(neighbours)) {}
+
+    size_t voxelCount() const { return occupied.size(); }
+
+    template <typename PointT>
+    void setMap(const pcl::PointCloud<PointT> &map)
+    {
+        occupied.clear();
+        for (const PointT &p : map.points)
+            occupied.insert(voxelKey(Eigen::Vector3d(p.x, p.y, p.z), resolution));
+    }
+
+    bool isOccupied(const Eigen::Vector3d &point) const
+    {
+        Eigen::Vector3i key = voxelKey(point, resolution);
+        for (const Eigen::Vector3i &offset : offsets)
+            if (occupied.count(key + offset))
+                return true;
+        return false;
+    }
+
+    /**
+     * @brief keep the scan points that land in occupied map voxels
+     *
+     * @param scan scan in car frame
+     * @param guess map <- car transformation of the coarse alignment
+     * @param output static points, still in car frame
+     * @return number of dropped points
+     */
+    template <typename PointT>
+    int filter(const pcl::PointCloud<PointT> &scan, const Eigen::Matrix4f &guess, pcl::PointCloud<PointT> &output) const
+    {
+        Eigen::Isometry3d T(guess.cast<double>());
+        pcl::PointCloud<PointT> kept;
+        kept.reserve(scan.size());
+        for (const PointT &p : scan.points)
+            if (isOccupied(T * Eigen::Vector3d(p.x, p.y, p.z)))
+                kept.push_back(p);
+        int dropped = scan.size() - kept.size();
+        kept.header = scan.header;
+        output.swap(kept);
+        return dropped;
+    }
+};
+
+#endif // MAP_OCCUPANCY_H
@@ -11,6 +11,8 @@
 #include <pcl/filters/passthrough.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include "point_to_plane.h"
+
 #define FilePath "/home/louis/sdc_ws/data/nuscenes_maps"
 
 using namespace std;
@@ -46,7 +48,11 @@ int main(int argc, char **argv){
 
     ros::init(argc, argv, "icp_locolization");
     ros::NodeHandle n("~");
-    
+    // normals for point-to-plane registration are computed here once instead of at every localizer start
+    bool save_normals;
+    int normal_k;
+    n.param<bool>("save_normals", save_normals, false);
+    n.param<int>("normal_k", normal_k, 10);
 
     vector<string> pcd_file_name;
 
@@ -68,5 +74,13 @@ int main(int argc, char **argv){
     // output merged pcd map
     pcl::io::savePCDFileASCII(FilePath + string("/") + string("merged.pcd"), *cloud_out);
 
+    // same map with a normal per point, input of the point_to_plane registration
+    if(save_normals){
+        NormalMap map_normals;
+        estimateMapNormals<pcl::PointXYZI>(cloud_out, normal_k, map_normals);
+        pcl::io::savePCDFileBinary(FilePath + string("/") + string("merged_normals.pcd"), map_normals);
+        cout << "saved " << map_normals.size() << " points with normals" << endl;
+    }
+
     return 0;
 }
@@ -0,0 +1,93 @@
+#ifndef MOTION_PREDICTOR_H
+#define MOTION_PREDICTOR_H
+
+#include <deque>
+
+#include "se3_utils.h"
+
+/**
+ * @brief Constant velocity motion model on SE(3).
+ *
+ * Keeps the most recent registered poses and extrapolates the next one with
+ * the body frame twist (translation and yaw/pitch/roll rate together) averaged
+ * over the history, so ICP starts where the vehicle is expected to be instead
+ * of where it was.
+ */
+class MotionPredictor
+{
+    struct StampedPose
+    {
+        double stamp;
+        Eigen::Isometry3d pose;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    std::deque<StampedPose, Eigen::aligned_allocator<StampedPose>> history;
+    size_t historySize;
+    double maxGap;
+
+public:
+    /**
+     * @param history_size number of poses the velocity is averaged over (at least 2)
+     * @param max_gap longest time in seconds the model may extrapolate over
+     */
+    MotionPredictor(size_t history_size = 3, double max_gap = 0.5)
+        : historySize(history_size < 2 ? 2 : history_size), maxGap(max_gap) {}
+
+    void setHistorySize(size_t size) { historySize = size < 2 ? 2 : size; }
+    void setMaxGap(double gap) { maxGap = gap; }
+    void reset() { history.clear(); }
+
+    void addPose(double stamp, const Eigen::Isometry3d &pose)
+    {
+        if (!history.empty() && stamp <= history.back().stamp)
+            history.clear();
+        history.push_back({stamp, pose});
+        while (history.size() > historySize)
+            history.pop_front();
+    }
+
+    /**
+     * @brief body frame twist per second averaged over the history
+     *
+     * @return false if fewer than two poses are stored
+     */
+    bool velocity(Vector6d &twist) const
+    {
+        if (history.size() < 2)
+            return false;
+
+        double span = history.back().stamp - history.front().stamp;
+        if (span <= 0)
+            return false;
+
+        twist.setZero();
+        for (size_t i = 1; i < history.size(); i++)
+            twist += logSE3(history[i - 1].pose.inverse() * history[i].pose);
+        twist /= span;
+        return true;
+    }
+
+    /**
+     * @brief extrapolate the pose at stamp
+     *
+     * @param stamp query time in seconds
+     * @param pose predicted pose
+     * @return false if there is not enough history or the gap is too large
+     */
+    bool predict(double stamp, Eigen::Isometry3d &pose) const
+    {
+        Vector6d twist;
+        if (!velocity(twist))
+            return false;
+
+        double dt = stamp - history.back().stamp;
+        if (dt < 0 || dt > maxGap)
+            return false;
+
+        pose = history.back().pose * expSE3(twist * dt);
+        return true;
+    }
+};
+
+#endif // MOTION_PREDICTOR_H
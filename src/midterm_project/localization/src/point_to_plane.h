@@ -0,0 +1,215 @@
+#ifndef POINT_TO_PLANE_H
+#define POINT_TO_PLANE_H
+
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "gn_registration.h"
+#include "voxel_local_map.h"
+
+typedef pcl::PointXYZINormal MapPoint;
+typedef pcl::PointCloud<MapPoint> NormalMap;
+
+/**
+ * @brief estimate map normals once, for the map tooling or when the map was saved without them
+ *
+ * @param map points of the map
+ * @param k neighbours of the local plane fit
+ * @param out map points with normals, points without a valid plane are dropped
+ */
+template <typename PointT>
+void estimateMapNormals(const typename pcl::PointCloud<PointT>::ConstPtr &map, int k, NormalMap &out)
+{
+    pcl::PointCloud<pcl::Normal> normals;
+    typename pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>);
+    pcl::NormalEstimationOMP<PointT, pcl::Normal> estimation;
+    estimation.setInputCloud(map);
+    estimation.setSearchMethod(tree);
+    estimation.setKSearch(k);
+    estimation.compute(normals);
+
+    out.clear();
+    out.reserve(map->size());
+    for (size_t i = 0; i < map->size(); i++)
+    {
+        const pcl::Normal &n = normals.points[i];
+        if (!std::isfinite(n.normal_x) || !std::isfinite(n.normal_y) || !std::isfinite(n.normal_z))
+            continue;
+        MapPoint p;
+        p.x = map->points[i].x;
+        p.y = map->points[i].y;
+        p.z = map->points[i].z;
+        p.intensity = map->points[i].intensity;
+        p.normal_x = n.normal_x;
+        p.normal_y = n.normal_y;
+        p.normal_z = n.normal_z;
+        p.curvature = n.curvature;
+        out.push_back(p);
+    }
+    out.width = out.size();
+    out.height = 1;
+    out.is_dense = true;
+}
+
+/**
+ * @brief Gauss-Newton point-to-plane registration against a map with normals.
+ *
+ * The kd-tree of the map is built once in setInputTarget(), or the
+ * correspondences come from a VoxelLocalMap kept around the vehicle by the
+ * caller; an iteration is a nearest neighbour query per scan point and a 6x6
+ * solve. The Jacobian of the residual n^T (T p - q) w.r.t. the left
+ * perturbation is [n^T, (T p x n)^T].
+ *
+ * With correspondence reuse (kd-tree only) a point keeps its map point while
+ * it moved less than the reuse distance since the last search, and the first
+ * iteration of a frame starts from the map points found by the previous
+ * frames in the same small voxel. Any close point on the same surface gives
+ * the same point-to-plane residual, so the late iterations, where the pose
+ * barely changes, skip most kd-tree queries.
+ */
+class PointToPlaneRegistration : public GaussNewtonRegistration
+{
+    NormalMap::ConstPtr target;
+    pcl::KdTreeFLANN<MapPoint> tree;
+    const VoxelLocalMap<MapPoint> *localMap = nullptr;
+
+    double reuseDistance = 0;
+    std::vector<int> cachedIndex;
+    std::vector<Eigen::Vector3d> searchedAt;
+    std::unordered_map<Eigen::Vector3i, int, VoxelKeyHash> hints;
+    size_t searches = 0;
+
+    /**
+     * @brief index of the map point paired with source point i, -1 if none
+     *
+     */
+    int correspondence(size_t i, const Eigen::Vector3d &world, std::vector<int> &index, std::vector<float> &sqr_distance)
+    {
+        double reuse_sqr = reuseDistance * reuseDistance;
+        if (reuseDistance > 0)
+        {
+            if (cachedIndex[i] >= 0 && (world - searchedAt[i]).squaredNorm() < reuse_sqr)
+                return cachedIndex[i];
+
+            if (cachedIndex[i] < 0)
+            {
+                auto hint = hints.find(voxelKey(world, reuseDistance));
+                if (hint != hints.end() &&
+                    (world - target->points[hint->second].getVector3fMap().cast<double>()).squaredNorm() < reuse_sqr)
+                {
+                    cachedIndex[i] = hint->second;
+                    searchedAt[i] = world;
+                    return hint->second;
+                }
+            }
+        }
+
+        MapPoint query;
+        query.x = world.x();
+        query.y = world.y();
+        query.z = world.z();
+        searches++;
+        int found = -1;
+        if (tree.nearestKSearch(query, 1, index, sqr_distance) > 0 &&
+            sqr_distance[0] <= maxCorrespondenceDistance * maxCorrespondenceDistance)
+            found = index[0];
+
+        if (reuseDistance > 0)
+        {
+            cachedIndex[i] = found;
+            searchedAt[i] = world;
+            if (found >= 0)
+                hints[voxelKey(world, reuseDistance)] = found;
+        }
+        return found;
+    }
+
+protected:
+    void prepareSource() override
+    {
+        searches = 0;
+        if (reuseDistance <= 0)
+            return;
+        cachedIndex.assign(source.size(), -1);
+        searchedAt.resize(source.size());
+        // hints only go stale in size, the map itself does not change
+        if (hints.size() > 1000000)
+            hints.clear();
+    }
+
+    int linearize(const Eigen::Isometry3d &T, Matrix6d &H, Vector6d &g, double &sqr_sum) override
+    {
+        std::vector<int> index(1);
+        std::vector<float> sqr_distance(1);
+        int count = 0;
+
+        for (size_t i = 0; i < source.size(); i++)
+        {
+            Eigen::Vector3d world = T * source[i];
+            const MapPoint *nearest;
+            if (localMap)
+            {
+                double sqr;
+                if (!(nearest = localMap->nearest(world, maxCorrespondenceDistance, sqr)))
+                    continue;
+            }
+            else
+            {
+                int found = correspondence(i, world, index, sqr_distance);
+                if (found < 0)
+                    continue;
+                nearest = &target->points[found];
+            }
+
+            const MapPoint &q = *nearest;
+            Eigen::Vector3d normal(q.normal_x, q.normal_y, q.normal_z);
+            double residual = normal.dot(world - Eigen::Vector3d(q.x, q.y, q.z));
+
+            Vector6d J;
+            J.head<3>() = normal;
+            J.tail<3>() = world.cross(normal);
+            double w = robustWeight(residual);
+            H += w * J * J.transpose();
+            g += w * J * residual;
+            sqr_sum += w * residual * residual;
+            addResidual(residual);
+            count++;
+        }
+        return count;
+    }
+
+public:
+    void setInputTarget(const NormalMap::ConstPtr &map)
+    {
+        target = map;
+        tree.setInputCloud(map);
+        hints.clear();
+    }
+
+    /**
+     * @brief search correspondences in a local map instead of the kd-tree, nullptr to switch back
+     *
+     */
+    void setLocalMap(const VoxelLocalMap<MapPoint> *map) { localMap = map; }
+
+    /**
+     * @brief reuse a correspondence while its point moved less than this distance, 0 disables
+     *
+     */
+    void setCorrespondenceReuse(double distance)
+    {
+        reuseDistance = distance;
+        hints.clear();
+    }
+
+    /** @brief kd-tree queries of the last align() */
+    size_t getSearchCount() const { return searches; }
+};
+
+#endif // POINT_TO_PLANE_H
@@ -0,0 +1,94 @@
+#ifndef POSE_INTERPOLATION_H
+#define POSE_INTERPOLATION_H
+
+#include <Eigen/Geometry>
+
+#include "state_buffer.h"
+
+/**
+ * @brief convert a buffered sample into a homogeneous transformation
+ *
+ */
+inline Eigen::Isometry3d toIsometry(const StampedState &state)
+{
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = Eigen::Quaterniond(state.qw, state.qx, state.qy, state.qz).normalized().toRotationMatrix();
+    pose.translation() = Eigen::Vector3d(state.x, state.y, state.z);
+    return pose;
+}
+
+/**
+ * @brief convert a homogeneous transformation into a sample at a time stamp
+ *
+ */
+inline StampedState toState(const Eigen::Isometry3d &pose, double stamp)
+{
+    Eigen::Quaterniond q(pose.linear());
+    StampedState state;
+    state.stamp = stamp;
+    state.x = pose.translation().x();
+    state.y = pose.translation().y();
+    state.z = pose.translation().z();
+    state.qx = q.x();
+    state.qy = q.y();
+    state.qz = q.z();
+    state.qw = q.w();
+    return state;
+}
+
+/**
+ * @brief interpolate (lerp + slerp) between two samples, ratio outside [0, 1] extrapolates
+ *
+ */
+inline Eigen::Isometry3d interpolate(const StampedState &older, const StampedState &newer, double ratio)
+{
+    Eigen::Quaterniond q0(older.qw, older.qx, older.qy, older.qz);
+    Eigen::Quaterniond q1(newer.qw, newer.qx, newer.qy, newer.qz);
+    Eigen::Vector3d p0(older.x, older.y, older.z);
+    Eigen::Vector3d p1(newer.x, newer.y, newer.z);
+
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = q0.normalized().slerp(ratio, q1.normalized()).toRotationMatrix();
+    pose.translation() = p0 + ratio * (p1 - p0);
+    return pose;
+}
+
+/**
+ * @brief pose of a buffered stream at an arbitrary time stamp
+ *
+ * @param buffer time ordered samples (e.g. wheel odometry)
+ * @param stamp query time in seconds
+ * @param max_extrapolation how far past the newest sample the pose may be extrapolated
+ * @param pose interpolated pose
+ * @return false if stamp is not covered by the buffer
+ */
+template <size_t N>
+bool interpolatePose(const StateBuffer<StampedState, N> &buffer, double stamp, double max_extrapolation, Eigen::Isometry3d &pose)
+{
+    StampedState newer, older;
+    if (!buffer.getPair(0, newer, older))
+        return false;
+
+    // query newer than the last sample, extrapolate with the last motion
+    if (stamp >= newer.stamp)
+    {
+        if (stamp - newer.stamp > max_extrapolation || newer.stamp <= older.stamp)
+            return false;
+        pose = interpolate(older, newer, (stamp - older.stamp) / (newer.stamp - older.stamp));
+        return true;
+    }
+
+    // every bracket is read as one snapshot so a concurrent push cannot tear it
+    for (size_t age = 0; buffer.getPair(age, newer, older); age++)
+    {
+        if (older.stamp <= stamp)
+        {
+            double span = newer.stamp - older.stamp;
+            pose = span > 0 ? interpolate(older, newer, (stamp - older.stamp) / span) : toIsometry(newer);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // POSE_INTERPOLATION_H
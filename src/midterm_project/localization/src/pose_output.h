@@ -0,0 +1,133 @@
+#ifndef POSE_OUTPUT_H
+#define POSE_OUTPUT_H
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <ros/ros.h>
+#include <geometry_msgs/PoseStamped.h>
+
+#include "state_buffer.h"
+#include "pose_interpolation.h"
+
+/**
+ * @brief High rate pose output between lidar corrections.
+ *
+ * The lidar stage hands every corrected pose to correct(); a worker thread
+ * moves the newest one forward by the buffered odometry motion since its stamp
+ * and publishes it at a fixed rate, stamped with the time the pose is valid
+ * for. Both inputs are lock-free buffers, so the worker never waits on ICP.
+ */
+class PoseOutput
+{
+    const StateBuffer<StampedState> &odom;
+    StateBuffer<StampedState, 8> corrected;
+    ros::Publisher publisher;
+    std::string frameId;
+    double rate;
+    double maxExtrapolation;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    void run()
+    {
+        ros::Rate loop(rate);
+        double last_stamp = 0;
+        while (running && ros::ok())
+        {
+            StampedState correction, newest;
+            if (corrected.latest(correction))
+            {
+                // latency compensation: pose at the current time, bounded by the odometry extrapolation limit
+                double stamp = correction.stamp;
+                Eigen::Isometry3d pose = toIsometry(correction);
+                Eigen::Isometry3d odom_then, odom_now;
+                if (odom.latest(newest) && newest.stamp > correction.stamp &&
+                    interpolatePose(odom, correction.stamp, maxExtrapolation, odom_then))
+                {
+                    stamp = std::min(ros::Time::now().toSec(), newest.stamp + maxExtrapolation);
+                    if (interpolatePose(odom, stamp, maxExtrapolation, odom_now))
+                        pose = pose * odom_then.inverse() * odom_now;
+                    else
+                        stamp = correction.stamp;
+                }
+
+                if (stamp > last_stamp)
+                {
+                    publish(stamp, pose);
+                    last_stamp = stamp;
+                }
+            }
+            loop.sleep();
+        }
+    }
+
+    void publish(double stamp, const Eigen::Isometry3d &pose)
+    {
+        Eigen::Quaterniond q(pose.linear());
+        geometry_msgs::PoseStamped msg;
+        msg.header.stamp = ros::Time(stamp);
+        msg.header.frame_id = frameId;
+        msg.pose.position.x = pose.translation().x();
+        msg.pose.position.y = pose.translation().y();
+        msg.pose.position.z = pose.translation().z();
+        msg.pose.orientation.x = q.x();
+        msg.pose.orientation.y = q.y();
+        msg.pose.orientation.z = q.z();
+        msg.pose.orientation.w = q.w();
+        publisher.publish(msg);
+    }
+
+public:
+    /**
+     * @param odom_buffer odometry written by the sensor callbacks
+     * @param pub publisher of geometry_msgs::PoseStamped
+     * @param frame_id frame of the published poses
+     * @param output_rate publishing rate in Hz
+     * @param max_extrapolation how far past the newest odometry the pose may be predicted
+     */
+    PoseOutput(const StateBuffer<StampedState> &odom_buffer, ros::Publisher pub, const std::string &frame_id,
+               double output_rate = 100.0, double max_extrapolation = 0.05)
+        : odom(odom_buffer), publisher(pub), frameId(frame_id), rate(output_rate),
+          maxExtrapolation(max_extrapolation), running(false) {}
+
+    ~PoseOutput() { stop(); }
+
+    void start()
+    {
+        if (running)
+            return;
+        running = true;
+        worker = std::thread(&PoseOutput::run, this);
+    }
+
+    void stop()
+    {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+    }
+
+    /**
+     * @brief hand over a corrected pose (lidar stage), never blocks
+     *
+     */
+    void correct(double stamp, const Eigen::Isometry3d &pose)
+    {
+        Eigen::Quaterniond q(pose.linear());
+        StampedState state;
+        state.stamp = stamp;
+        state.x = pose.translation().x();
+        state.y = pose.translation().y();
+        state.z = pose.translation().z();
+        state.qx = q.x();
+        state.qy = q.y();
+        state.qz = q.z();
+        state.qw = q.w();
+        corrected.push(state);
+    }
+};
+
+#endif // POSE_OUTPUT_H
@@ -0,0 +1,208 @@
+#ifndef RANGE_IMAGE_H
+#define RANGE_IMAGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "lidar_rings.h"
+
+/**
+ * @brief Ring x azimuth range image of one lidar sweep.
+ *
+ * A scan is projected once (O(n), no sorting or hashing) into a dense grid of
+ * rings x columns that keeps the nearest return of every cell. Range gating,
+ * outlier removal, downsampling and normals then only look at the fixed image
+ * neighbours of a cell; the buffers are reused between scans.
+ */
+class ScanRangeImage
+{
+public:
+    LidarRings geometry;
+    int columns = 1080; // about one return per cell for a 32 beam sensor at 20 Hz
+    double minRange = 1.0;
+    double maxRange = 100.0;
+    // neighbours within this fraction of the range belong to the same surface
+    double neighbourRatio = 0.1;
+    // tangent neighbours of a normal are at most this fraction of the range away
+    double normalRatio = 0.3;
+
+private:
+    std::vector<Eigen::Vector3f> xyz;
+    std::vector<float> intensity;
+    std::vector<float> range; // 0 marks an empty cell
+    std::vector<char> keep;
+    std::vector<int> block;
+
+    int cell(int row, int column) const
+    {
+        return row * columns + (column + columns) % columns;
+    }
+
+    bool sameSurface(int a, int b) const
+    {
+        return range[b] > 0 && std::abs(range[a] - range[b]) < neighbourRatio * range[a];
+    }
+
+    bool tangentNeighbour(int a, int b) const
+    {
+        return range[b] > 0 && (xyz[b] - xyz[a]).norm() < normalRatio * range[a];
+    }
+
+    /**
+     * @brief surface normal of a cell from its image neighbours, facing the sensor
+     *
+     * @return false without a neighbour in both directions
+     */
+    bool normal(int row, int column, Eigen::Vector3f &n) const
+    {
+        int c = cell(row, column);
+        Eigen::Vector3f tangents[2];
+        int neighbours[2][2] = {{cell(row, column - 1), cell(row, column + 1)}, {-1, -1}};
+        if (row > 0)
+            neighbours[1][0] = cell(row - 1, column);
+        if (row + 1 < geometry.rings)
+            neighbours[1][1] = cell(row + 1, column);
+
+        for (int axis = 0; axis < 2; axis++)
+        {
+            int before = neighbours[axis][0], after = neighbours[axis][1];
+            bool has_before = before >= 0 && tangentNeighbour(c, before);
+            bool has_after = after >= 0 && tangentNeighbour(c, after);
+            if (has_before && has_after)
+                tangents[axis] = xyz[after] - xyz[before];
+            else if (has_after)
+                tangents[axis] = xyz[after] - xyz[c];
+            else if (has_before)
+                tangents[axis] = xyz[c] - xyz[before];
+            else
+                return false;
+        }
+
+        n = tangents[0].cross(tangents[1]);
+        float norm = n.norm();
+        if (norm < 1e-6f)
+            return false;
+        n /= norm;
+        if (n.dot(xyz[c]) > 0)
+            n = -n;
+        return true;
+    }
+
+public:
+    /**
+     * @brief fill the image from a scan in lidar frame, returns outside the range gate are dropped
+     *
+     */
+    template <typename PointT>
+    void project(const pcl::PointCloud<PointT> &scan)
+    {
+        int size = geometry.rings * columns;
+        xyz.resize(size);
+        intensity.resize(size);
+        range.assign(size, 0.0f);
+
+        for (const PointT &p : scan.points)
+        {
+            float r = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (!std::isfinite(r) || r < minRange || r > maxRange)
+                continue;
+            int row = geometry.ring(p);
+            if (row < 0)
+                continue;
+            int column = int((std::atan2(p.y, p.x) + M_PI) / (2 * M_PI) * columns);
+            int c = cell(row, std::min(column, columns - 1));
+            if (range[c] > 0 && range[c] <= r)
+                continue;
+            xyz[c] = Eigen::Vector3f(p.x, p.y, p.z);
+            intensity[c] = p.intensity;
+            range[c] = r;
+        }
+    }
+
+    /**
+     * @brief drop returns without a neighbour on the same surface among their 8 image neighbours
+     *
+     * @return number of removed returns
+     */
+    int removeOutliers()
+    {
+        keep.assign(range.size(), 0);
+        for (int row = 0; row < geometry.rings; row++)
+            for (int column = 0; column < columns; column++)
+            {
+                int c = cell(row, column);
+                if (range[c] <= 0)
+                    continue;
+                for (int dr = -1; dr <= 1 && !keep[c]; dr++)
+                {
+                    if (row + dr < 0 || row + dr >= geometry.rings)
+                        continue;
+                    for (int dc = -1; dc <= 1; dc++)
+                        if ((dr || dc) && sameSurface(c, cell(row + dr, column + dc)))
+                        {
+                            keep[c] = 1;
+                            break;
+                        }
+                }
+            }
+
+        int removed = 0;
+        for (size_t c = 0; c < range.size(); c++)
+            if (range[c] > 0 && !keep[c])
+            {
+                range[c] = 0;
+                removed++;
+            }
+        return removed;
+    }
+
+    /**
+     * @brief one return per block of rows x columns (the one of median range), with its normal
+     *
+     * @param out downsampled scan, normals are NaN where the image has no tangent neighbours
+     */
+    void extract(int row_step, int column_step, pcl::PointCloud<pcl::PointXYZINormal> &out)
+    {
+        out.clear();
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (int row = 0; row < geometry.rings; row += row_step)
+            for (int column = 0; column < columns; column += column_step)
+            {
+                block.clear();
+                for (int r = row; r < std::min(row + row_step, geometry.rings); r++)
+                    for (int k = column; k < std::min(column + column_step, columns); k++)
+                        if (range[cell(r, k)] > 0)
+                            block.push_back(cell(r, k));
+                if (block.empty())
+                    continue;
+                std::nth_element(block.begin(), block.begin() + block.size() / 2, block.end(),
+                                 [&](int a, int b) { return range[a] < range[b]; });
+                int c = block[block.size() / 2];
+
+                pcl::PointXYZINormal p;
+                p.x = xyz[c].x();
+                p.y = xyz[c].y();
+                p.z = xyz[c].z();
+                p.intensity = intensity[c];
+                p.curvature = 0;
+                Eigen::Vector3f n;
+                if (normal(c / columns, c % columns, n))
+                {
+                    p.normal_x = n.x();
+                    p.normal_y = n.y();
+                    p.normal_z = n.z();
+                }
+                else
+                    p.normal_x = p.normal_y = p.normal_z = nan;
+                out.push_back(p);
+            }
+    }
+};
+
+#endif // RANGE_IMAGE_H
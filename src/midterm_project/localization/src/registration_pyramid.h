@@ -0,0 +1,132 @@
+#ifndef REGISTRATION_PYRAMID_H
+#define REGISTRATION_PYRAMID_H
+
+#include <memory>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/registration/transformation_estimation_2D.h>
+
+#include "icp_registration.h"
+#include "local_origin.h"
+
+/**
+ * @brief Coarse-to-fine registration against a voxelized map pyramid.
+ *
+ * Every level holds the map downsampled once at its leaf size together with an
+ * ICP whose target (and kd-tree) stays set between scans. A scan is aligned on
+ * the coarsest level first, each result seeds the next level, and the last
+ * level seeds the full resolution registration done by the caller. The levels
+ * can be expressed around a LocalOrigin like the full resolution target.
+ */
+template <typename PointT>
+class RegistrationPyramid
+{
+    typedef pcl::PointCloud<PointT> Cloud;
+    typedef MeteredICP<PointT, PointT> ICP;
+
+    struct Level
+    {
+        float leaf;
+        // world frame level map, the ICP target may be shifted to a local origin
+        typename Cloud::Ptr map;
+        std::shared_ptr<ICP> icp;
+    };
+
+    std::vector<Level> levels;
+
+public:
+    bool empty() const { return levels.empty(); }
+
+    /**
+     * @brief estimate x, y and yaw only on every level, call after build()
+     *
+     */
+    void setPlanar()
+    {
+        for (Level &level : levels)
+            level.icp->setTransformationEstimation(
+                typename pcl::registration::TransformationEstimation2D<PointT, PointT>::Ptr(
+                    new pcl::registration::TransformationEstimation2D<PointT, PointT>));
+    }
+
+    /**
+     * @brief shift the level targets to a local origin, scan guesses must be local too
+     *
+     * Call again whenever the origin moves, every level rebuilds its kd-tree.
+     */
+    void setOrigin(const LocalOrigin &origin)
+    {
+        for (Level &level : levels)
+        {
+            typename Cloud::Ptr local_map(new Cloud);
+            origin.toLocal(*level.map, *local_map);
+            level.icp->setInputTarget(local_map);
+        }
+    }
+
+    /**
+     * @brief build the map levels, coarsest first
+     *
+     * @param map full resolution map
+     * @param leaf_sizes voxel size of every level, sorted from coarse to fine
+     * @param distance_factor correspondence distance of a level in leaf sizes
+     * @param max_iterations iteration cap of a level
+     */
+    void build(const typename Cloud::ConstPtr &map, const std::vector<float> &leaf_sizes,
+               double distance_factor = 3.0, int max_iterations = 30)
+    {
+        levels.clear();
+        for (float leaf : leaf_sizes)
+        {
+            typename Cloud::Ptr level_map(new Cloud);
+            pcl::VoxelGrid<PointT> voxel_filter;
+            voxel_filter.setInputCloud(map);
+            voxel_filter.setLeafSize(leaf, leaf, leaf);
+            voxel_filter.filter(*level_map);
+
+            Level level;
+            level.leaf = leaf;
+            level.map = level_map;
+            level.icp = std::make_shared<ICP>();
+            level.icp->setInputTarget(level_map);
+            level.icp->setMaximumIterations(max_iterations);
+            level.icp->setTransformationEpsilon(1e-6);
+            level.icp->setMaxCorrespondenceDistance(distance_factor * leaf);
+            level.icp->setEuclideanFitnessEpsilon(1e-4);
+            levels.push_back(level);
+        }
+    }
+
+    /**
+     * @brief align the scan level by level
+     *
+     * @param scan scan in car frame
+     * @param guess initial guess, replaced by the result of the finest level
+     * @return iterations spent over all levels
+     */
+    int align(const typename Cloud::ConstPtr &scan, Eigen::Matrix4f &guess)
+    {
+        int iterations = 0;
+        Cloud aligned;
+        for (Level &level : levels)
+        {
+            typename Cloud::Ptr level_scan(new Cloud);
+            pcl::VoxelGrid<PointT> voxel_filter;
+            voxel_filter.setInputCloud(scan);
+            voxel_filter.setLeafSize(level.leaf, level.leaf, level.leaf);
+            voxel_filter.filter(*level_scan);
+
+            level.icp->setInputSource(level_scan);
+            level.icp->align(aligned, guess);
+            iterations += level.icp->getIterations();
+            // a level stopped by the iteration cap may have diverged and would only spoil the seed of the finer ones
+            if (level.icp->reachedCriterion())
+                guess = level.icp->getFinalTransformation();
+        }
+        return iterations;
+    }
+};
+
+#endif // REGISTRATION_PYRAMID_H
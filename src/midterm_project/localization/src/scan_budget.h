@@ -0,0 +1,94 @@
+#ifndef SCAN_BUDGET_H
+#define SCAN_BUDGET_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/filters/voxel_grid.h>
+
+/**
+ * @brief Voxel downsampling that holds the scan near a target point count.
+ *
+ * The leaf is the base leaf times a scale adapted from frame to frame: the
+ * points of a mostly surface-like scan grow with 1 / leaf^2, so the next scale
+ * is scale * sqrt(count / target). Consecutive scans are alike, the controller
+ * follows the scene density within a few frames; a scan still above the
+ * target by more than the tolerance (a sudden dense block) is cut to the
+ * target with a fixed stride over the voxel-ordered points, which keeps the
+ * spatial spread.
+ */
+template <typename PointT>
+class AdaptiveVoxelFilter
+{
+    typedef pcl::PointCloud<PointT> Cloud;
+
+    Eigen::Vector3f baseLeaf;
+    int target;
+    double scale;
+    double minScale, maxScale;
+    double tolerance;
+    bool heightLimits;
+    double minHeight, maxHeight;
+
+public:
+    AdaptiveVoxelFilter(const Eigen::Vector3f &base_leaf = Eigen::Vector3f(0.1f, 0.1f, 0.4f), int target_points = 5000)
+        : baseLeaf(base_leaf), target(target_points), scale(1.0), minScale(0.5), maxScale(10.0), tolerance(0.2),
+          heightLimits(false), minHeight(0), maxHeight(0) {}
+
+    void setTarget(int points) { target = points; }
+    /** @brief bounds of the leaf scale */
+    void setScaleLimits(double min_scale, double max_scale)
+    {
+        minScale = min_scale;
+        maxScale = max_scale;
+    }
+    /** @brief keep only points with z in [min, max], as VoxelGrid::setFilterLimits */
+    void setHeightLimits(double min, double max)
+    {
+        heightLimits = true;
+        minHeight = min;
+        maxHeight = max;
+    }
+    /** @brief leaf scale the next scan is filtered with */
+    double getScale() const { return scale; }
+
+    /**
+     * @brief downsample one scan and adapt the leaf for the next
+     *
+     * @param cloud scan
+     * @param output at most target * (1 + tolerance) points
+     */
+    void filter(const typename Cloud::ConstPtr &cloud, Cloud &output)
+    {
+        Eigen::Vector3f leaf = baseLeaf * float(scale);
+        Cloud voxelized;
+        pcl::VoxelGrid<PointT> voxel_filter;
+        voxel_filter.setInputCloud(cloud);
+        if (heightLimits)
+        {
+            voxel_filter.setFilterFieldName("z");
+            voxel_filter.setFilterLimits(minHeight, maxHeight);
+        }
+        voxel_filter.setLeafSize(leaf.x(), leaf.y(), leaf.z());
+        voxel_filter.filter(voxelized);
+
+        int count = voxelized.size();
+        if (count > 0)
+            scale = std::min(maxScale, std::max(minScale, scale * std::sqrt(double(count) / target)));
+
+        if (count <= target * (1.0 + tolerance))
+        {
+            output.swap(voxelized);
+            return;
+        }
+        output.clear();
+        output.reserve(target);
+        double stride = double(count) / target;
+        for (int k = 0; k < target; k++)
+            output.push_back(voxelized.points[int(k * stride)]);
+    }
+};
+
+#endif // SCAN_BUDGET_H
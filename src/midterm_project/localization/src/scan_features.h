@@ -0,0 +1,145 @@
+#ifndef SCAN_FEATURES_H
+#define SCAN_FEATURES_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "lidar_rings.h"
+
+/**
+ * @brief Edge and planar feature selection on the scan lines (LOAM style).
+ *
+ * Points are grouped per ring and ordered by azimuth. The curvature of a point
+ * is the norm of sum(p_j - p_i) over window neighbours on each side, relative to
+ * its range. Each ring is split into sectors; per sector the sharpest points
+ * above edgeThreshold become edges and the smoothest below planarThreshold
+ * become planar points, up to a budget, with the window around a selected
+ * point suppressed. Points next to a range discontinuity (occlusion) are not
+ * used as edges.
+ */
+template <typename PointT>
+class ScanFeatureExtractor
+{
+public:
+    LidarRings geometry;
+    int window = 5;
+    int sectors = 6;
+    int edgesPerSector = 4;
+    int planarsPerSector = 8;
+    double edgeThreshold = 0.2;
+    double planarThreshold = 0.02;
+    double minRange = 1.0;
+    double occlusionRatio = 0.1;
+
+    /**
+     * @brief select the features of one scan
+     *
+     * @param scan scan in lidar frame
+     * @param edges sharp points, for point-to-line residuals
+     * @param planars flat points, for point-to-plane residuals
+     */
+    void extract(const pcl::PointCloud<PointT> &scan, pcl::PointCloud<PointT> &edges, pcl::PointCloud<PointT> &planars) const
+    {
+        edges.clear();
+        planars.clear();
+
+        std::vector<std::vector<std::pair<float, int>>> lines(geometry.rings);
+        for (size_t i = 0; i < scan.size(); i++)
+        {
+            const PointT &p = scan.points[i];
+            if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                continue;
+            if (p.x * p.x + p.y * p.y + p.z * p.z < minRange * minRange)
+                continue;
+            int ring = geometry.ring(p);
+            if (ring >= 0)
+                lines[ring].push_back(std::make_pair(std::atan2(p.y, p.x), int(i)));
+        }
+
+        std::vector<float> range, curvature;
+        std::vector<char> picked, usable;
+        std::vector<int> order;
+        for (auto &line : lines)
+        {
+            int n = line.size();
+            if (n < 2 * window + 1 + sectors)
+                continue;
+            std::sort(line.begin(), line.end());
+
+            range.resize(n);
+            for (int k = 0; k < n; k++)
+            {
+                const PointT &p = scan.points[line[k].second];
+                range[k] = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            }
+
+            curvature.assign(n, 0);
+            picked.assign(n, 0);
+            usable.assign(n, 0);
+            for (int k = window; k < n - window; k++)
+            {
+                const PointT &p = scan.points[line[k].second];
+                float dx = 0, dy = 0, dz = 0;
+                for (int j = -window; j <= window; j++)
+                {
+                    const PointT &q = scan.points[line[k + j].second];
+                    dx += q.x - p.x;
+                    dy += q.y - p.y;
+                    dz += q.z - p.z;
+                }
+                curvature[k] = std::sqrt(dx * dx + dy * dy + dz * dz) / (2 * window * range[k]);
+                usable[k] = std::abs(range[k + 1] - range[k]) < occlusionRatio * range[k] &&
+                            std::abs(range[k - 1] - range[k]) < occlusionRatio * range[k];
+            }
+
+            for (int s = 0; s < sectors; s++)
+            {
+                int begin = window + (n - 2 * window) * s / sectors;
+                int end = window + (n - 2 * window) * (s + 1) / sectors;
+                order.resize(end - begin);
+                for (int k = begin; k < end; k++)
+                    order[k - begin] = k;
+                std::sort(order.begin(), order.end(), [&](int a, int b) { return curvature[a] < curvature[b]; });
+
+                int selected = 0;
+                for (auto it = order.rbegin(); it != order.rend() && selected < edgesPerSector; ++it)
+                {
+                    int k = *it;
+                    if (curvature[k] < edgeThreshold)
+                        break;
+                    if (picked[k] || !usable[k])
+                        continue;
+                    edges.push_back(scan.points[line[k].second]);
+                    suppress(picked, k, n);
+                    selected++;
+                }
+
+                selected = 0;
+                for (auto it = order.begin(); it != order.end() && selected < planarsPerSector; ++it)
+                {
+                    int k = *it;
+                    if (curvature[k] > planarThreshold)
+                        break;
+                    if (picked[k] || !usable[k])
+                        continue;
+                    planars.push_back(scan.points[line[k].second]);
+                    suppress(picked, k, n);
+                    selected++;
+                }
+            }
+        }
+    }
+
+private:
+    void suppress(std::vector<char> &picked, int k, int n) const
+    {
+        for (int j = std::max(0, k - window); j <= std::min(n - 1, k + window); j++)
+            picked[j] = 1;
+    }
+};
+
+#endif // SCAN_FEATURES_H
@@ -0,0 +1,102 @@
+#ifndef SE3_UTILS_H
+#define SE3_UTILS_H
+
+#include <cmath>
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+
+/**
+ * @brief skew symmetric matrix, skew(a) * b == a.cross(b)
+ *
+ */
+inline Eigen::Matrix3d skew(const Eigen::Vector3d &v)
+{
+    Eigen::Matrix3d m;
+    m <<     0, -v(2),  v(1),
+          v(2),     0, -v(0),
+         -v(1),  v(0),     0;
+    return m;
+}
+
+/**
+ * @brief exponential map of a rotation vector
+ *
+ */
+inline Eigen::Matrix3d expSO3(const Eigen::Vector3d &phi)
+{
+    double theta = phi.norm();
+    if (theta < 1e-10)
+        return Eigen::Matrix3d::Identity() + skew(phi);
+    return Eigen::AngleAxisd(theta, phi / theta).toRotationMatrix();
+}
+
+/**
+ * @brief logarithm map of a rotation matrix
+ *
+ */
+inline Eigen::Vector3d logSO3(const Eigen::Matrix3d &R)
+{
+    Eigen::AngleAxisd aa(R);
+    return aa.angle() * aa.axis();
+}
+
+/**
+ * @brief exponential map of a twist xi = [rho (translation), phi (rotation)]
+ *
+ */
+inline Eigen::Isometry3d expSE3(const Vector6d &xi)
+{
+    Eigen::Vector3d rho = xi.head<3>(), phi = xi.tail<3>();
+    double theta = phi.norm();
+    Eigen::Matrix3d Phi = skew(phi);
+    Eigen::Matrix3d V = Eigen::Matrix3d::Identity();
+    if (theta < 1e-10)
+        V += 0.5 * Phi;
+    else
+        V += (1 - std::cos(theta)) / (theta * theta) * Phi + (theta - std::sin(theta)) / (theta * theta * theta) * Phi * Phi;
+
+    Eigen::Isometry3d T = Eigen::Isometry3d::Identity();
+    T.linear() = expSO3(phi);
+    T.translation() = V * rho;
+    return T;
+}
+
+/**
+ * @brief logarithm map of a rigid transformation, inverse of expSE3
+ *
+ */
+inline Vector6d logSE3(const Eigen::Isometry3d &T)
+{
+    Eigen::Vector3d phi = logSO3(T.linear());
+    double theta = phi.norm();
+    Eigen::Matrix3d Phi = skew(phi);
+    Eigen::Matrix3d V_inv = Eigen::Matrix3d::Identity() - 0.5 * Phi;
+    if (theta > 1e-10)
+        V_inv += (1 - theta * std::sin(theta) / (2 * (1 - std::cos(theta)))) / (theta * theta) * Phi * Phi;
+
+    Vector6d xi;
+    xi.head<3>() = V_inv * T.translation();
+    xi.tail<3>() = phi;
+    return xi;
+}
+
+/**
+ * @brief geodesic interpolation, weight 0 gives a and weight 1 gives b
+ *
+ */
+inline Eigen::Isometry3d interpolateSE3(const Eigen::Isometry3d &a, const Eigen::Isometry3d &b, double weight)
+{
+    return a * expSE3(weight * logSE3(a.inverse() * b));
+}
+
+inline Eigen::Isometry3d toIsometry(const Eigen::Matrix4f &m)
+{
+    Eigen::Isometry3d T;
+    T.matrix() = m.cast<double>();
+    return T;
+}
+
+#endif // SE3_UTILS_H
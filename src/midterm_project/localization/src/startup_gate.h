@@ -0,0 +1,145 @@
+#ifndef STARTUP_GATE_H
+#define STARTUP_GATE_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+
+/**
+ * @brief Initialization state machine of a localizer node.
+ *
+ * Scans arriving before both the map and the GPS prior are available are kept
+ * in a bounded ring instead of blocking inside the subscriber callback. Once
+ * both dependencies resolve, release() hands back either every buffered scan or
+ * only the latest one, depending on the policy.
+ *
+ * @tparam MsgPtr message pointer type of the buffered scans
+ */
+template <typename MsgPtr>
+class StartupGate
+{
+public:
+    enum State
+    {
+        WAITING_MAP_AND_GPS,
+        WAITING_MAP,
+        WAITING_GPS,
+        READY
+    };
+
+    enum Policy
+    {
+        PROCESS_ALL,
+        KEEP_LATEST
+    };
+
+    StartupGate(size_t capacity = 10, Policy policy = KEEP_LATEST)
+        : capacity(capacity), policy(policy), state(WAITING_MAP_AND_GPS),
+          dropped(0), firstPoseReported(false), startTime(ros::WallTime::now()) {}
+
+    void setCapacity(size_t cap) { capacity = cap > 0 ? cap : 1; }
+    void setPolicy(Policy p) { policy = p; }
+    void setPolicy(const std::string &name) { policy = (name == "all") ? PROCESS_ALL : KEEP_LATEST; }
+
+    State getState() const { return state; }
+    bool isReady() const { return state == READY; }
+
+    void setMapReady()
+    {
+        if (state == WAITING_MAP_AND_GPS)
+            transit(WAITING_GPS);
+        else if (state == WAITING_MAP)
+            transit(READY);
+    }
+
+    void setGpsReady()
+    {
+        if (state == WAITING_MAP_AND_GPS)
+            transit(WAITING_MAP);
+        else if (state == WAITING_GPS)
+            transit(READY);
+    }
+
+    /**
+     * @brief decide whether a scan can be processed now, buffering it otherwise
+     *
+     * @param msg incoming scan
+     * @return true if the gate is open and the caller should process msg
+     */
+    bool admit(const MsgPtr &msg)
+    {
+        if (state == READY)
+            return true;
+
+        if (pending.size() >= capacity)
+        {
+            pending.pop_front();
+            dropped++;
+        }
+        pending.push_back(msg);
+        return false;
+    }
+
+    /**
+     * @brief take the scans buffered during startup, applying the release policy
+     *
+     * @return scans to be processed in arrival order, empty if not ready yet
+     */
+    std::vector<MsgPtr> release()
+    {
+        std::vector<MsgPtr> out;
+        if (state != READY || pending.empty())
+            return out;
+
+        if (policy == KEEP_LATEST)
+        {
+            dropped += pending.size() - 1;
+            out.push_back(pending.back());
+        }
+        else
+        {
+            out.assign(pending.begin(), pending.end());
+        }
+        pending.clear();
+
+        if (dropped > 0)
+            ROS_WARN("startup: dropped %zu scan(s) received before map and gps were ready", dropped);
+        return out;
+    }
+
+    /**
+     * @brief report time-to-first-pose once, call after every published pose
+     */
+    void markPose()
+    {
+        if (firstPoseReported)
+            return;
+        firstPoseReported = true;
+        ROS_INFO("time to first pose: %.3f s (%.3f s after map and gps ready)",
+                 (ros::WallTime::now() - startTime).toSec(),
+                 (ros::WallTime::now() - readyTime).toSec());
+    }
+
+private:
+    void transit(State next)
+    {
+        state = next;
+        if (state == READY)
+        {
+            readyTime = ros::WallTime::now();
+            ROS_INFO("startup: map and gps ready after %.3f s, %zu scan(s) pending",
+                     (readyTime - startTime).toSec(), pending.size());
+        }
+    }
+
+    size_t capacity;
+    Policy policy;
+    State state;
+    std::deque<MsgPtr> pending;
+    size_t dropped;
+    bool firstPoseReported;
+    ros::WallTime startTime, readyTime;
+};
+
+#endif // STARTUP_GATE_H
@@ -0,0 +1,163 @@
+#ifndef STATE_BUFFER_H
+#define STATE_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * @brief Timestamped pose sample written by high-rate sensor callbacks
+ *
+ */
+struct StampedState
+{
+    double stamp;
+    double x, y, z;
+    double qx, qy, qz, qw;
+};
+
+/**
+ * @brief Lock-free ring of the newest N samples of a sensor stream.
+ *
+ * One writer (the sensor callback) and any number of readers (the lidar stage).
+ * Every slot is guarded by a sequence counter: the writer makes it odd while
+ * copying and even again when done, readers retry if the counter changed under
+ * them. Neither side ever takes a lock or waits on the other.
+ *
+ * @tparam T trivially copyable sample type
+ * @tparam N capacity of the ring
+ */
+template <typename T, size_t N = 256>
+class StateBuffer
+{
+    static_assert(std::is_trivially_copyable<T>::value, "StateBuffer needs a trivially copyable type");
+    static_assert(N > 1, "StateBuffer needs at least two slots");
+
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+
+    Slot slots[N];
+    std::atomic<uint64_t> head;
+
+public:
+    StateBuffer() : head(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+
+    StateBuffer(const StateBuffer &) = delete;
+    StateBuffer &operator=(const StateBuffer &) = delete;
+
+    /**
+     * @brief append a sample, overwriting the oldest one when full (single writer)
+     *
+     * @param value sample to store
+     */
+    void push(const T &value)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Slot &slot = slots[h % N];
+        uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.value = value;
+        slot.seq.store(seq + 2, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief read the sample written age pushes ago (0 = newest)
+     *
+     * @param age how many samples back from the newest
+     * @param out copy of the sample
+     * @return false if fewer than age + 1 samples are available
+     */
+    bool get(size_t age, T &out) const
+    {
+        while (true)
+        {
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (age >= h || age >= N - 1)
+                return false;
+
+            const Slot &slot = slots[(h - 1 - age) % N];
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+
+            T copy = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = slot.seq.load(std::memory_order_relaxed);
+
+            // slot untouched and not lapped by the writer while we were copying
+            if (before == after && head.load(std::memory_order_relaxed) - h < N - 1 - age)
+            {
+                out = copy;
+                return true;
+            }
+        }
+    }
+
+    bool latest(T &out) const { return get(0, out); }
+
+    /**
+     * @brief read two consecutive samples written under the same head
+     *
+     * Two separate get() calls can straddle a push and return a pair that is
+     * out of order or has a gap; here both copies are retried together.
+     *
+     * @param age age of the newer sample (0 = newest)
+     * @param newer copy of the sample at age
+     * @param older copy of the sample at age + 1
+     * @return false if fewer than age + 2 samples are available
+     */
+    bool getPair(size_t age, T &newer, T &older) const
+    {
+        while (true)
+        {
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (age + 1 >= h || age + 1 >= N - 1)
+                return false;
+
+            const Slot &newer_slot = slots[(h - 1 - age) % N];
+            const Slot &older_slot = slots[(h - 2 - age) % N];
+            uint64_t newer_before = newer_slot.seq.load(std::memory_order_acquire);
+            uint64_t older_before = older_slot.seq.load(std::memory_order_acquire);
+            if ((newer_before | older_before) & 1)
+                continue;
+
+            T newer_copy = newer_slot.value;
+            T older_copy = older_slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t newer_after = newer_slot.seq.load(std::memory_order_relaxed);
+            uint64_t older_after = older_slot.seq.load(std::memory_order_relaxed);
+
+            // both slots untouched and not lapped by the writer while we were copying
+            if (newer_before == newer_after && older_before == older_after &&
+                head.load(std::memory_order_relaxed) - h < N - 2 - age)
+            {
+                newer = newer_copy;
+                older = older_copy;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief number of samples currently readable
+     *
+     */
+    size_t size() const
+    {
+        uint64_t h = head.load(std::memory_order_acquire);
+        return h < N - 1 ? static_cast<size_t>(h) : N - 1;
+    }
+};
+
+#endif // STATE_BUFFER_H
@@ -0,0 +1,208 @@
+#ifndef TRANSFORM_CACHE_H
+#define TRANSFORM_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+#include <tf2_msgs/TFMessage.h>
+
+/**
+ * @brief Cache of static transforms on top of a tf::TransformListener.
+ *
+ * Static extrinsics are resolved once with a non-blocking lookup and kept as
+ * Eigen::Isometry3d, chains of frames are composed once and cached as a whole.
+ * The per-message cost is a map lookup instead of a TF tree query and a wait.
+ *
+ * A new /tf_static message reaches this class and the listener on different
+ * queues, so clearing the cache on arrival could re-cache the old value the
+ * listener still holds. The received links are kept as pending instead and the
+ * cache is dropped once the listener resolves them to the new values.
+ */
+class TransformCache
+{
+    typedef std::map<std::string, Eigen::Isometry3d, std::less<std::string>,
+                     Eigen::aligned_allocator<std::pair<const std::string, Eigen::Isometry3d>>>
+        Cache;
+
+    tf::TransformListener &listener;
+    ros::Subscriber subStatic;
+    std::mutex mutex;
+    Cache cache;
+
+    // static links received on /tf_static that the listener may not hold yet, by child frame
+    struct PendingLink
+    {
+        std::string parent;
+        Eigen::Isometry3d transform;
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    typedef std::map<std::string, PendingLink, std::less<std::string>,
+                     Eigen::aligned_allocator<std::pair<const std::string, PendingLink>>>
+        Pending;
+    Pending pending;
+
+    static std::string key(const std::vector<std::string> &frames)
+    {
+        std::string k;
+        for (const auto &frame : frames)
+            k += frame + "<";
+        return k;
+    }
+
+    /**
+     * @brief query the listener without waiting
+     *
+     * @param warn report a transform that is not available yet
+     */
+    bool resolve(const std::string &target, const std::string &source, Eigen::Isometry3d &out, bool warn = true)
+    {
+        tf::StampedTransform transform;
+        std::string error;
+        if (!listener.canTransform(target, source, ros::Time(0), &error))
+        {
+            if (warn)
+                ROS_WARN_THROTTLE(1.0, "transform %s <- %s not available yet: %s", target.c_str(), source.c_str(), error.c_str());
+            return false;
+        }
+        try
+        {
+            listener.lookupTransform(target, source, ros::Time(0), transform);
+        }
+        catch (tf::TransformException &ex)
+        {
+            ROS_ERROR("%s", ex.what());
+            return false;
+        }
+
+        Eigen::Quaterniond q(transform.getRotation().getW(), transform.getRotation().getX(),
+                             transform.getRotation().getY(), transform.getRotation().getZ());
+        out = Eigen::Isometry3d::Identity();
+        out.linear() = q.toRotationMatrix();
+        out.translation() = Eigen::Vector3d(transform.getOrigin().getX(), transform.getOrigin().getY(), transform.getOrigin().getZ());
+        return true;
+    }
+
+    /**
+     * @brief drop the cache once the listener has caught up with a pending static link
+     *
+     */
+    void syncStatic()
+    {
+        Pending links;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.empty())
+                return;
+            links = pending;
+        }
+
+        std::vector<std::string> applied;
+        for (const auto &link : links)
+        {
+            Eigen::Isometry3d current;
+            if (resolve(link.second.parent, link.first, current, false) && current.isApprox(link.second.transform, 1e-6))
+                applied.push_back(link.first);
+        }
+        if (applied.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &child : applied)
+        {
+            // a newer message may have replaced the link meanwhile, keep waiting for that one
+            Pending::iterator it = pending.find(child);
+            if (it != pending.end() && it->second.parent == links.at(child).parent &&
+                it->second.transform.isApprox(links.at(child).transform, 1e-6))
+                pending.erase(it);
+        }
+        cache.clear();
+    }
+
+public:
+    /**
+     * @param nh node handle whose callback queue serves the /tf_static subscription
+     * @param tf_listener listener shared with the node
+     */
+    TransformCache(ros::NodeHandle nh, tf::TransformListener &tf_listener) : listener(tf_listener)
+    {
+        subStatic = nh.subscribe("/tf_static", 10, &TransformCache::staticCallback, this);
+    }
+
+    void invalidate()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cache.clear();
+    }
+
+    void staticCallback(const tf2_msgs::TFMessage::ConstPtr &msg)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &t : msg->transforms)
+        {
+            PendingLink link;
+            link.parent = t.header.frame_id;
+            link.transform = Eigen::Isometry3d::Identity();
+            link.transform.linear() = Eigen::Quaterniond(t.transform.rotation.w, t.transform.rotation.x,
+                                                         t.transform.rotation.y, t.transform.rotation.z).normalized().toRotationMatrix();
+            link.transform.translation() = Eigen::Vector3d(t.transform.translation.x, t.transform.translation.y, t.transform.translation.z);
+            pending[t.child_frame_id] = link;
+        }
+    }
+
+    /**
+     * @brief transform of source expressed in target (target <- source)
+     *
+     * @return false if the transform is not available yet, never blocks
+     */
+    bool lookup(const std::string &target, const std::string &source, Eigen::Isometry3d &out)
+    {
+        return lookupChain({target, source}, out);
+    }
+
+    /**
+     * @brief composed transform frames[0] <- frames[1] <- ... <- frames[n - 1]
+     *
+     * @param frames chain of frame names, at least two
+     * @param out precomposed transformation
+     * @return false if any link is not available yet, never blocks
+     */
+    bool lookupChain(const std::vector<std::string> &frames, Eigen::Isometry3d &out)
+    {
+        if (frames.size() < 2)
+            return false;
+
+        syncStatic();
+
+        std::string k = key(frames);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Cache::const_iterator it = cache.find(k);
+            if (it != cache.end())
+            {
+                out = it->second;
+                return true;
+            }
+        }
+
+        Eigen::Isometry3d chain = Eigen::Isometry3d::Identity();
+        for (size_t i = 1; i < frames.size(); i++)
+        {
+            Eigen::Isometry3d link;
+            if (!resolve(frames[i - 1], frames[i], link))
+                return false;
+            chain = chain * link;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        cache[k] = chain;
+        out = chain;
+        return true;
+    }
+};
+
+#endif // TRANSFORM_CACHE_H
@@ -0,0 +1,224 @@
+#ifndef VOXEL_GICP_H
+#define VOXEL_GICP_H
+
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "gn_registration.h"
+#include "voxel_hash.h"
+
+/**
+ * @brief covariance of every point from its k nearest neighbours, GICP plane regularized
+ *
+ * The eigenvalues are replaced by (1e-3, 1, 1) so every covariance describes a
+ * thin disc along the local surface, whatever the sampling density.
+ */
+inline void estimatePointCovariances(const std::vector<Eigen::Vector3d> &points, int k, std::vector<Eigen::Matrix3d> &covariances)
+{
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+    cloud->reserve(points.size());
+    for (const Eigen::Vector3d &p : points)
+        cloud->push_back(pcl::PointXYZ(p.x(), p.y(), p.z()));
+    pcl::KdTreeFLANN<pcl::PointXYZ> tree;
+    tree.setInputCloud(cloud);
+
+    covariances.resize(points.size());
+    const Eigen::Vector3d plane(1e-3, 1.0, 1.0);
+#pragma omp parallel for
+    for (int i = 0; i < (int)points.size(); i++)
+    {
+        std::vector<int> indices;
+        std::vector<float> sqr_distances;
+        int found = tree.nearestKSearch(cloud->points[i], k, indices, sqr_distances);
+        if (found < 3)
+        {
+            covariances[i] = Eigen::Matrix3d::Identity();
+            continue;
+        }
+
+        Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+        for (int idx : indices)
+            mean += points[idx];
+        mean /= found;
+        Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+        for (int idx : indices)
+            scatter += (points[idx] - mean) * (points[idx] - mean).transpose();
+
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(scatter / found);
+        covariances[i] = solver.eigenvectors() * plane.asDiagonal() * solver.eigenvectors().transpose();
+    }
+}
+
+/**
+ * @brief Voxelized generalized ICP against a voxel-hashed map.
+ *
+ * Each map voxel aggregates the mean and the mean covariance of its points
+ * (computed once in setInputTarget()). A scan point is paired with the voxels
+ * around it by a hash lookup instead of a kd-tree query, with the cost
+ * d^T (C_voxel + R C_point R^T)^-1 d, d = T p - mean. Far points stay usable
+ * without widening a correspondence gate, and the linearization runs in
+ * parallel over the scan points when built with OpenMP.
+ */
+class VoxelGICP : public GaussNewtonRegistration
+{
+    struct Voxel
+    {
+        int count = 0;
+        Eigen::Vector3d mean;
+        Eigen::Matrix3d covariance;
+    };
+    typedef std::unordered_map<Eigen::Vector3i, Voxel, VoxelKeyHash> VoxelMap;
+
+    VoxelMap voxels;
+    double resolution;
+    int kNeighbours;
+    int minPoints;
+    std::vector<Eigen::Vector3i> offsets;
+    std::vector<Eigen::Matrix3d> sourceCovariances;
+
+protected:
+    void prepareSource() override
+    {
+        estimatePointCovariances(source, kNeighbours, sourceCovariances);
+    }
+
+    int linearize(const Eigen::Isometry3d &T, Matrix6d &H, Vector6d &g, double &sqr_sum) override
+    {
+        const Eigen::Matrix3d R = T.linear();
+        const int n = source.size();
+        int count = 0;
+
+#pragma omp parallel
+        {
+            Matrix6d H_local = Matrix6d::Zero();
+            Vector6d g_local = Vector6d::Zero();
+            double sqr_local = 0;
+            int count_local = 0;
+            std::vector<double> residuals_local;
+
+#pragma omp for nowait
+            for (int i = 0; i < n; i++)
+            {
+                Eigen::Vector3d world = T * source[i];
+                Eigen::Matrix3d rotated = R * sourceCovariances[i] * R.transpose();
+                Eigen::Vector3i key = voxelKey(world, resolution);
+
+                Eigen::Matrix<double, 3, 6> J;
+                J.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
+                J.block<3, 3>(0, 3) = -skew(world);
+
+                for (const Eigen::Vector3i &offset : offsets)
+                {
+                    VoxelMap::const_iterator it = voxels.find(key + offset);
+                    if (it == voxels.end() || it->second.count < minPoints)
+                        continue;
+
+                    Eigen::Vector3d d = world - it->second.mean;
+                    Eigen::Matrix3d information = (it->second.covariance + rotated).inverse();
+                    // the kernel acts on the Mahalanobis distance
+                    double sqr_mahalanobis = d.dot(information * d);
+                    double w = robustWeight(std::sqrt(sqr_mahalanobis));
+                    H_local += w * J.transpose() * information * J;
+                    g_local += w * J.transpose() * information * d;
+                    sqr_local += w * sqr_mahalanobis;
+                    if (kernel != NONE)
+                        residuals_local.push_back(std::sqrt(sqr_mahalanobis));
+                    count_local++;
+                }
+            }
+
+#pragma omp critical
+            {
+                H += H_local;
+                g += g_local;
+                sqr_sum += sqr_local;
+                count += count_local;
+                residuals.insert(residuals.end(), residuals_local.begin(), residuals_local.end());
+            }
+        }
+        return count;
+    }
+
+public:
+    VoxelGICP() : resolution(1.0), kNeighbours(10), minPoints(3), offsets(voxelNeighbourOffsets(1)) {}
+
+    void setResolution(double r) { resolution = r; }
+    /** @brief neighbours of the per point covariances */
+    void setCovarianceNeighbours(int k) { kNeighbours = k; }
+    /** @brief voxels searched per scan point: 1, 7 or 27 */
+    void setVoxelNeighbours(int n) { offsets = voxelNeighbourOffsets(n); }
+    /** @brief voxels with fewer points are not used */
+    void setMinimumPoints(int n) { minPoints = n; }
+    size_t voxelCount() const { return voxels.size(); }
+
+    /**
+     * @brief align a scan whose normals are known (e.g. from the range image), skipping the k-NN covariances
+     *
+     * @param cloud scan points with normals, points with a NaN normal get an isotropic covariance
+     * @param guess initial map <- scan transformation
+     * @return true if converged
+     */
+    template <typename PointT>
+    bool alignWithNormals(const pcl::PointCloud<PointT> &cloud, const Eigen::Matrix4f &guess)
+    {
+        source.clear();
+        sourceCovariances.clear();
+        source.reserve(cloud.size());
+        sourceCovariances.reserve(cloud.size());
+        for (const auto &point : cloud.points)
+        {
+            source.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+            Eigen::Vector3d n(point.normal_x, point.normal_y, point.normal_z);
+            if (n.allFinite())
+            {
+                // same disc as estimatePointCovariances: 1e-3 along the normal, 1 in the plane
+                Eigen::Matrix3d nn = n * n.transpose();
+                sourceCovariances.push_back(1e-3 * nn + (Eigen::Matrix3d::Identity() - nn));
+            }
+            else
+                sourceCovariances.push_back(Eigen::Matrix3d::Identity());
+        }
+        return optimize(toIsometry(guess));
+    }
+
+    /**
+     * @brief voxelize the map, call after the setters
+     *
+     */
+    template <typename PointT>
+    void setInputTarget(const pcl::PointCloud<PointT> &map)
+    {
+        std::vector<Eigen::Vector3d> points;
+        points.reserve(map.size());
+        for (const auto &point : map.points)
+            points.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+        std::vector<Eigen::Matrix3d> covariances;
+        estimatePointCovariances(points, kNeighbours, covariances);
+
+        voxels.clear();
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            Voxel &voxel = voxels[voxelKey(points[i], resolution)];
+            if (voxel.count == 0)
+            {
+                voxel.mean.setZero();
+                voxel.covariance.setZero();
+            }
+            voxel.count++;
+            voxel.mean += points[i];
+            voxel.covariance += covariances[i];
+        }
+        for (auto &entry : voxels)
+        {
+            entry.second.mean /= entry.second.count;
+            entry.second.covariance /= entry.second.count;
+        }
+    }
+};
+
+#endif // VOXEL_GICP_H
@@ -0,0 +1,61 @@
+#ifndef VOXEL_HASH_H
+#define VOXEL_HASH_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <Eigen/Core>
+
+/**
+ * @brief spatial hash of integer voxel coordinates, for std::unordered_map
+ *
+ */
+struct VoxelKeyHash
+{
+    size_t operator()(const Eigen::Vector3i &key) const
+    {
+        return (size_t(key.x()) * 73856093) ^ (size_t(key.y()) * 19349669) ^ (size_t(key.z()) * 83492791);
+    }
+};
+
+/**
+ * @brief voxel containing a point
+ *
+ */
+inline Eigen::Vector3i voxelKey(const Eigen::Vector3d &point, double resolution)
+{
+    return Eigen::Vector3i(int(std::floor(point.x() / resolution)),
+                           int(std::floor(point.y() / resolution)),
+                           int(std::floor(point.z() / resolution)));
+}
+
+/**
+ * @brief offsets of the voxels searched around a key
+ *
+ * @param neighbours 1 (the voxel itself), 7 (and its faces) or 27 (full cube)
+ */
+inline std::vector<Eigen::Vector3i> voxelNeighbourOffsets(int neighbours)
+{
+    std::vector<Eigen::Vector3i> offsets;
+    offsets.push_back(Eigen::Vector3i::Zero());
+    if (neighbours == 7)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            offsets.push_back(Eigen::Vector3i::Unit(axis));
+            offsets.push_back(-Eigen::Vector3i::Unit(axis));
+        }
+    }
+    else if (neighbours == 27)
+    {
+        for (int x = -1; x <= 1; x++)
+            for (int y = -1; y <= 1; y++)
+                for (int z = -1; z <= 1; z++)
+                    if (x || y || z)
+                        offsets.push_back(Eigen::Vector3i(x, y, z));
+    }
+    return offsets;
+}
+
+#endif // VOXEL_HASH_H
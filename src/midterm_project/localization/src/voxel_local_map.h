@@ -0,0 +1,171 @@
+#ifndef VOXEL_LOCAL_MAP_H
+#define VOXEL_LOCAL_MAP_H
+
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/StdVector>
+#include <pcl/point_cloud.h>
+
+#include "voxel_hash.h"
+
+/**
+ * @brief Local map around the vehicle kept in a hashed voxel grid.
+ *
+ * The global map is bucketed once into vertical columns of blockVoxels x
+ * blockVoxels voxels, thinned to at most maxPoints points per voxel. update()
+ * inserts the columns entering the radius and evicts the ones leaving it, so
+ * its cost follows what changed; nearest() only visits the voxels around the
+ * query.
+ */
+template <typename PointT>
+class VoxelLocalMap
+{
+    typedef std::vector<PointT, Eigen::aligned_allocator<PointT>> Points;
+    typedef std::unordered_map<Eigen::Vector3i, Points, VoxelKeyHash> Grid;
+
+    double resolution;
+    int maxPoints;
+    double radius;
+    int blockVoxels;
+
+    Grid blocks; // global map, key (column x, column y, 0)
+    Grid voxels; // local map
+    std::unordered_set<Eigen::Vector3i, VoxelKeyHash> active;
+    bool hasCenter;
+    Eigen::Vector3i centerBlock;
+
+    Eigen::Vector3i blockKey(const Eigen::Vector3d &point) const
+    {
+        double size = resolution * blockVoxels;
+        return Eigen::Vector3i(int(std::floor(point.x() / size)), int(std::floor(point.y() / size)), 0);
+    }
+
+    void insertBlock(const Points &points)
+    {
+        for (const PointT &point : points)
+            voxels[voxelKey(Eigen::Vector3d(point.x, point.y, point.z), resolution)].push_back(point);
+    }
+
+    void evictBlock(const Points &points)
+    {
+        for (const PointT &point : points)
+            voxels.erase(voxelKey(Eigen::Vector3d(point.x, point.y, point.z), resolution));
+    }
+
+public:
+    /**
+     * @param voxel_size edge of a voxel, the usual correspondence distance
+     * @param max_points points kept per voxel
+     * @param local_radius horizontal radius of the local map around the vehicle
+     * @param block_voxels voxels per column edge, the unit of insertion and eviction
+     */
+    VoxelLocalMap(double voxel_size = 1.0, int max_points = 20, double local_radius = 100.0, int block_voxels = 10)
+        : resolution(voxel_size), maxPoints(max_points), radius(local_radius), blockVoxels(block_voxels), hasCenter(false) {}
+
+    size_t voxelCount() const { return voxels.size(); }
+
+    /**
+     * @brief bucket the global map, the local map is filled by the next update()
+     *
+     */
+    void setGlobalMap(const pcl::PointCloud<PointT> &map)
+    {
+        blocks.clear();
+        voxels.clear();
+        active.clear();
+        hasCenter = false;
+
+        std::unordered_map<Eigen::Vector3i, int, VoxelKeyHash> occupancy;
+        for (const PointT &point : map.points)
+        {
+            Eigen::Vector3d p(point.x, point.y, point.z);
+            if (occupancy[voxelKey(p, resolution)]++ < maxPoints)
+                blocks[blockKey(p)].push_back(point);
+        }
+    }
+
+    /**
+     * @brief move the local map to a new vehicle position
+     *
+     * @return number of columns inserted and evicted
+     */
+    int update(const Eigen::Vector3d &center)
+    {
+        Eigen::Vector3i key = blockKey(center);
+        if (hasCenter && key == centerBlock)
+            return 0;
+        hasCenter = true;
+        centerBlock = key;
+
+        double size = resolution * blockVoxels;
+        int range = int(std::ceil(radius / size));
+        std::unordered_set<Eigen::Vector3i, VoxelKeyHash> needed;
+        for (int x = -range; x <= range; x++)
+            for (int y = -range; y <= range; y++)
+            {
+                Eigen::Vector3i block = key + Eigen::Vector3i(x, y, 0);
+                Eigen::Vector2d block_center((block.x() + 0.5) * size, (block.y() + 0.5) * size);
+                if ((block_center - center.head<2>()).norm() <= radius && blocks.count(block))
+                    needed.insert(block);
+            }
+
+        int changed = 0;
+        for (auto it = active.begin(); it != active.end();)
+        {
+            if (needed.count(*it))
+            {
+                ++it;
+                continue;
+            }
+            evictBlock(blocks[*it]);
+            it = active.erase(it);
+            changed++;
+        }
+        for (const Eigen::Vector3i &block : needed)
+        {
+            if (active.insert(block).second)
+            {
+                insertBlock(blocks[block]);
+                changed++;
+            }
+        }
+        return changed;
+    }
+
+    /**
+     * @brief nearest local map point within max_distance
+     *
+     * @return nullptr if there is none
+     */
+    const PointT *nearest(const Eigen::Vector3d &query, double max_distance, double &sqr_distance) const
+    {
+        int range = int(std::ceil(max_distance / resolution));
+        Eigen::Vector3i key = voxelKey(query, resolution);
+        const PointT *best = nullptr;
+        sqr_distance = max_distance * max_distance;
+
+        for (int x = -range; x <= range; x++)
+            for (int y = -range; y <= range; y++)
+                for (int z = -range; z <= range; z++)
+                {
+                    typename Grid::const_iterator it = voxels.find(key + Eigen::Vector3i(x, y, z));
+                    if (it == voxels.end())
+                        continue;
+                    for (const PointT &point : it->second)
+                    {
+                        double d = (Eigen::Vector3d(point.x, point.y, point.z) - query).squaredNorm();
+                        if (d <= sqr_distance)
+                        {
+                            sqr_distance = d;
+                            best = &point;
+                        }
+                    }
+                }
+        return best;
+    }
+};
+
+#endif // VOXEL_LOCAL_MAP_H
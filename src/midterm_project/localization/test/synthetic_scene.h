@@ -0,0 +1,81 @@
+#ifndef SYNTHETIC_SCENE_H
+#define SYNTHETIC_SCENE_H
+
+#include <algorithm>
+
+#include <Eigen/Geometry>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "point_to_plane.h"
+
+/**
+ * @brief map with normals of a corner: ground z = 0 and the walls x = 8 and y = 8
+ *
+ * Three orthogonal planes constrain all six degrees of freedom.
+ */
+inline NormalMap::Ptr cornerMap(float spacing = 0.25f)
+{
+    NormalMap::Ptr map(new NormalMap);
+    auto add = [&](float x, float y, float z, float nx, float ny, float nz) {
+        MapPoint p;
+        p.x = x;
+        p.y = y;
+        p.z = z;
+        p.normal_x = nx;
+        p.normal_y = ny;
+        p.normal_z = nz;
+        map->push_back(p);
+    };
+    for (float a = -8; a < 8; a += spacing)
+    {
+        for (float b = -8; b < 8; b += spacing)
+            add(a, b, 0, 0, 0, 1);
+        for (float z = spacing; z < 4; z += spacing)
+        {
+            add(8, a, z, -1, 0, 0);
+            add(a, 8, z, 0, -1, 0);
+        }
+    }
+    return map;
+}
+
+/**
+ * @brief every stride-th map point seen from a car at pose, in the car frame
+ *
+ */
+inline pcl::PointCloud<pcl::PointXYZI> scanOf(const NormalMap &map, const Eigen::Isometry3d &pose, int stride)
+{
+    pcl::PointCloud<pcl::PointXYZI> scan;
+    Eigen::Isometry3d inverse = pose.inverse();
+    for (size_t i = 0; i < map.size(); i += stride)
+    {
+        Eigen::Vector3d p = inverse * map.points[i].getVector3fMap().cast<double>();
+        pcl::PointXYZI q;
+        q.x = p.x();
+        q.y = p.y();
+        q.z = p.z();
+        scan.push_back(q);
+    }
+    return scan;
+}
+
+inline Eigen::Isometry3d testPose(double x, double y, double z, double yaw)
+{
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    pose.translation() = Eigen::Vector3d(x, y, z);
+    return pose;
+}
+
+/**
+ * @brief largest of the translation error and the rotation error in radians
+ *
+ */
+inline double poseError(const Eigen::Matrix4f &result, const Eigen::Isometry3d &truth)
+{
+    Eigen::Isometry3d delta = truth.inverse() * Eigen::Isometry3d(result.cast<double>());
+    return std::max(delta.translation().norm(), Eigen::AngleAxisd(delta.linear()).angle());
+}
+
+#endif // SYNTHETIC_SCENE_H
@@ -0,0 +1,124 @@
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <pcl/point_types.h>
+
+#include "deskew.h"
+
+namespace
+{
+
+const double kPeriod = 0.1;
+const double kSpeed = 15.0; // m/s along x
+const double kYawRate = 0.5; // rad/s
+
+/** @brief sensor pose at sweep fraction s, start of the sweep at the origin */
+Eigen::Isometry3d sensorPose(double s)
+{
+    double t = s * kPeriod;
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = Eigen::AngleAxisd(kYawRate * t, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    pose.translation() = Eigen::Vector3d(kSpeed * t, 0, 0);
+    return pose;
+}
+
+/**
+ * @brief one clockwise sweep of the moving sensor, the beam turns a full revolution in the sensor frame
+ *
+ * @param scan points in the sensor frame at their own time, intensity holds the point index
+ * @param s true sweep fraction of every point
+ * @param expected every point in the sensor frame at the end of the sweep
+ */
+void movingSweep(int points, pcl::PointCloud<pcl::PointXYZI> &scan, std::vector<float> &s, std::vector<Eigen::Vector3d> &expected)
+{
+    Eigen::Isometry3d end_inverse = sensorPose(1).inverse();
+    scan.clear();
+    s.clear();
+    expected.clear();
+    for (int i = 0; i < points; i++)
+    {
+        double fraction = double(i) / points;
+        double azimuth = -2 * M_PI * fraction;
+        Eigen::Vector3d seen(20 * std::cos(azimuth), 20 * std::sin(azimuth), -1.5 + 3.0 * (i % 16) / 15);
+        Eigen::Vector3d world = sensorPose(fraction) * seen;
+        pcl::PointXYZI p;
+        p.x = seen.x();
+        p.y = seen.y();
+        p.z = seen.z();
+        p.intensity = i;
+        scan.push_back(p);
+        s.push_back(fraction);
+        expected.push_back(end_inverse * world);
+    }
+}
+
+/** @brief knots at k / bins, end of the sweep <- sensor */
+std::vector<Eigen::Isometry3f> sweepKnots(int bins)
+{
+    std::vector<Eigen::Isometry3f> knots;
+    Eigen::Isometry3d end_inverse = sensorPose(1).inverse();
+    for (int k = 0; k <= bins; k++)
+        knots.push_back((end_inverse * sensorPose(double(k) / bins)).cast<float>());
+    return knots;
+}
+
+double meanError(const pcl::PointCloud<pcl::PointXYZI> &scan, const std::vector<Eigen::Vector3d> &expected)
+{
+    double sum = 0;
+    for (const pcl::PointXYZI &p : scan.points)
+        sum += (p.getVector3fMap().cast<double>() - expected[int(p.intensity)]).norm();
+    return sum / scan.size();
+}
+
+} // namespace
+
+TEST(ScanDeskew, ConstantVelocitySweep)
+{
+    pcl::PointCloud<pcl::PointXYZI> scan;
+    std::vector<float> s;
+    std::vector<Eigen::Vector3d> expected;
+    movingSweep(20000, scan, s, expected);
+
+    double skewed = meanError(scan, expected);
+    EXPECT_GT(skewed, 0.5);
+
+    ScanDeskew deskew;
+    deskew.apply(scan, s, sweepKnots(deskew.bins));
+    ASSERT_EQ(scan.size(), expected.size());
+    EXPECT_LT(meanError(scan, expected), 0.02);
+    for (const pcl::PointXYZI &p : scan.points)
+        EXPECT_LT((p.getVector3fMap().cast<double>() - expected[int(p.intensity)]).norm(), 0.05);
+}
+
+TEST(ScanDeskew, AzimuthTimesOfClockwiseSweep)
+{
+    pcl::PointCloud<pcl::PointXYZI> scan;
+    std::vector<float> s;
+    std::vector<Eigen::Vector3d> expected;
+    movingSweep(20000, scan, s, expected);
+
+    ScanDeskew deskew;
+    std::vector<float> estimated;
+    deskew.azimuthTimes(scan, estimated);
+    ASSERT_EQ(estimated.size(), s.size());
+    for (size_t i = 0; i < s.size(); i++)
+        EXPECT_NEAR(estimated[i], s[i], 1e-4);
+
+    deskew.apply(scan, estimated, sweepKnots(deskew.bins));
+    EXPECT_LT(meanError(scan, expected), 0.02);
+}
+
+TEST(ScanDeskew, EmptySweep)
+{
+    pcl::PointCloud<pcl::PointXYZI> scan;
+    ScanDeskew deskew;
+    deskew.apply(scan, std::vector<float>(), sweepKnots(deskew.bins));
+    EXPECT_TRUE(scan.empty());
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
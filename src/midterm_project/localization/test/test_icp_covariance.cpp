@@ -0,0 +1,91 @@
+#include <cmath>
+
+#include <gtest/gtest.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "error_state_kf.h"
+#include "icp_covariance.h"
+#include "synthetic_scene.h"
+
+namespace
+{
+
+/**
+ * @brief straight corridor along the corridor frame x axis: floor z = 0 and the walls y = -3 and y = 3
+ *
+ * Nothing constrains the translation along the corridor.
+ */
+pcl::PointCloud<pcl::PointXYZ>::Ptr corridorMap(const Eigen::Isometry3d &corridor, float spacing = 0.5f)
+{
+    pcl::PointCloud<pcl::PointXYZ>::Ptr map(new pcl::PointCloud<pcl::PointXYZ>);
+    auto add = [&](float x, float y, float z) {
+        Eigen::Vector3d p = corridor * Eigen::Vector3d(x, y, z);
+        map->push_back(pcl::PointXYZ(p.x(), p.y(), p.z()));
+    };
+    for (float x = -15; x < 15; x += spacing)
+    {
+        for (float y = -3; y <= 3; y += spacing)
+            add(x, y, 0);
+        for (float z = spacing; z < 4; z += spacing)
+        {
+            add(x, -3, z);
+            add(x, 3, z);
+        }
+    }
+    return map;
+}
+
+pcl::PointCloud<pcl::PointXYZ> corridorScan(const pcl::PointCloud<pcl::PointXYZ> &map, const Eigen::Isometry3d &pose)
+{
+    pcl::PointCloud<pcl::PointXYZ> scan;
+    Eigen::Isometry3d inverse = pose.inverse();
+    for (size_t i = 0; i < map.size(); i += 5)
+    {
+        Eigen::Vector3d p = inverse * map.points[i].getVector3fMap().cast<double>();
+        scan.push_back(pcl::PointXYZ(p.x(), p.y(), p.z()));
+    }
+    return scan;
+}
+
+} // namespace
+
+TEST(IcpCovariance, FilterCovarianceKeepsRotationInCarFrame)
+{
+    Matrix6d cov_car = Matrix6d::Zero();
+    cov_car.diagonal() << 4, 1e-4, 1e-4, 9, 1e-4, 1e-4;
+    cov_car(0, 3) = cov_car(3, 0) = 0.5;
+    Eigen::Matrix3d R = Eigen::AngleAxisd(M_PI / 2, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+
+    Matrix6d filter_cov = filterPoseCovariance(cov_car, R);
+    Eigen::Matrix3d rotation_cov = filter_cov.block<3, 3>(3, 3);
+    EXPECT_NEAR(filter_cov(1, 1), 4, 1e-9);                       // car x translation lies along map y
+    EXPECT_TRUE(rotation_cov.isApprox(cov_car.block<3, 3>(3, 3))); // rotation stays in the car frame
+    EXPECT_NEAR(filter_cov(1, 3), 0.5, 1e-9);                     // map y position against car roll
+}
+
+TEST(IcpCovariance, RotatedCorridorCollapsesAcrossTheCorridor)
+{
+    const double yaw = M_PI / 3;
+    Eigen::Isometry3d corridor = testPose(0, 0, 0, yaw);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr map = corridorMap(corridor);
+    Eigen::Isometry3d truth = testPose(1, 1.5, 0.5, yaw);
+    pcl::PointCloud<pcl::PointXYZ> scan = corridorScan(*map, truth);
+
+    pcl::KdTreeFLANN<pcl::PointXYZ> search;
+    search.setInputCloud(map);
+    RegistrationCovariance registration_cov;
+    ASSERT_TRUE(estimateRegistrationCovariance(scan, Eigen::Matrix4f(truth.matrix().cast<float>()), search, 1.0,
+                                               0.01, 10.0, registration_cov));
+    EXPECT_GE(registration_cov.degenerate_directions, 1);
+
+    ErrorStateKF eskf;
+    eskf.reset(truth, 1.0, 0.1);
+    eskf.updatePose(truth, filterPoseCovariance(registration_cov.covariance_car, truth.linear()));
+
+    Eigen::Matrix3d position_cov = eskf.poseCovariance().block<3, 3>(0, 0);
+    Eigen::Vector3d along(std::cos(yaw), std::sin(yaw), 0);
+    Eigen::Vector3d across(-std::sin(yaw), std::cos(yaw), 0);
+    EXPECT_GT(along.dot(position_cov * along), 0.5);   // degenerate axis keeps most of the prior
+    EXPECT_LT(across.dot(position_cov * across), 0.01); // walls pin the lateral position
+    EXPECT_LT(position_cov(2, 2), 0.01);                // floor pins the height
+}
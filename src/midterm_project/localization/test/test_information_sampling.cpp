@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "information_sampling.h"
+#include "point_to_plane.h"
+
+namespace
+{
+
+/**
+ * @brief corridor along x: floor, two walls and a few door frames, the only points that fix x
+ *
+ */
+NormalMap corridor(int points, double door_ratio)
+{
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> chance(0, 1), along(-50, 50), across(-2, 2), height(0, 3);
+    NormalMap cloud;
+    for (int i = 0; i < points; i++)
+    {
+        MapPoint p;
+        float pick = chance(rng);
+        if (pick < door_ratio)
+        {
+            // frame faces at x = -30, 0 and 25, 0.3 m deep into the walls
+            static const float doors[3] = {-30, 0, 25};
+            p.x = doors[i % 3];
+            p.y = (i % 2 ? 1.7f : -1.7f) + 0.3f * (chance(rng) - 0.5f);
+            p.z = height(rng);
+            p.normal_x = 1;
+        }
+        else if (pick < door_ratio + (1 - door_ratio) / 3)
+        {
+            p.x = along(rng);
+            p.y = across(rng);
+            p.z = 0;
+            p.normal_z = 1;
+        }
+        else
+        {
+            p.x = along(rng);
+            p.y = chance(rng) < 0.5f ? -2 : 2;
+            p.z = height(rng);
+            p.normal_y = p.y > 0 ? -1 : 1;
+        }
+        cloud.push_back(p);
+    }
+    return cloud;
+}
+
+/**
+ * @brief smallest eigenvalue of the point-to-plane information of the selected points
+ *
+ */
+double weakestInformation(const NormalMap &cloud, const std::vector<int> &selected)
+{
+    Matrix6d information = Matrix6d::Zero();
+    for (int i : selected)
+    {
+        const MapPoint &p = cloud.points[i];
+        Eigen::Vector3d n(p.normal_x, p.normal_y, p.normal_z);
+        Vector6d v;
+        v << n, Eigen::Vector3d(p.x, p.y, p.z).cross(n);
+        information += v * v.transpose();
+    }
+    return Eigen::SelfAdjointEigenSolver<Matrix6d>(information).eigenvalues()(0);
+}
+
+} // namespace
+
+TEST(InformationSampling, KeepsAllPointsUnderBudget)
+{
+    NormalMap cloud = corridor(100, 0.01);
+    cloud.points[5].normal_x = std::numeric_limits<float>::quiet_NaN();
+    std::vector<int> selected;
+    informationSampling(cloud, 500, selected);
+    EXPECT_EQ(selected.size(), 99u);
+    EXPECT_EQ(std::count(selected.begin(), selected.end(), 5), 0);
+}
+
+TEST(InformationSampling, CorridorKeepsTheAlongAxisConstraint)
+{
+    const int budget = 600;
+    NormalMap cloud = corridor(20000, 0.01);
+
+    std::vector<int> selected;
+    informationSampling(cloud, budget, selected);
+    ASSERT_EQ((int)selected.size(), budget);
+    EXPECT_TRUE(std::is_sorted(selected.begin(), selected.end()));
+    EXPECT_EQ(std::adjacent_find(selected.begin(), selected.end()), selected.end());
+
+    std::vector<int> uniform;
+    for (int k = 0; k < budget; k++)
+        uniform.push_back(k * (int)cloud.size() / budget);
+
+    double informed = weakestInformation(cloud, selected);
+    double strided = weakestInformation(cloud, uniform);
+    EXPECT_GT(informed, 3 * strided);
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
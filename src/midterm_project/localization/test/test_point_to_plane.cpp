@@ -0,0 +1,69 @@
+#include <memory>
+
+#include <gtest/gtest.h>
+
+#include "point_to_plane.h"
+#include "synthetic_scene.h"
+
+namespace
+{
+
+struct RunResult
+{
+    double error;
+    size_t searches;
+};
+
+RunResult alignCorner(PointToPlaneRegistration &registration, const NormalMap::Ptr &map, const Eigen::Isometry3d &truth,
+                      const Eigen::Isometry3d &guess = Eigen::Isometry3d::Identity())
+{
+    pcl::PointCloud<pcl::PointXYZI> scan = scanOf(*map, truth, 7);
+    registration.align(scan, guess.matrix().cast<float>());
+    EXPECT_TRUE(registration.hasConverged());
+    return RunResult{poseError(registration.getFinalTransformation(), truth), registration.getSearchCount()};
+}
+
+std::unique_ptr<PointToPlaneRegistration> cornerRegistration(const NormalMap::Ptr &map, double reuse)
+{
+    std::unique_ptr<PointToPlaneRegistration> registration(new PointToPlaneRegistration);
+    registration->setMaximumIterations(30);
+    registration->setMaxCorrespondenceDistance(1.0);
+    registration->setInputTarget(map);
+    registration->setCorrespondenceReuse(reuse);
+    return registration;
+}
+
+} // namespace
+
+TEST(PointToPlane, ConvergesOnCorner)
+{
+    NormalMap::Ptr map = cornerMap();
+    std::unique_ptr<PointToPlaneRegistration> registration = cornerRegistration(map, 0);
+    Eigen::Isometry3d truth = testPose(0.3, -0.2, 0.1, 0.05);
+    EXPECT_LT(alignCorner(*registration, map, truth).error, 1e-3);
+}
+
+TEST(PointToPlane, CorrespondenceReuseSkipsSearches)
+{
+    NormalMap::Ptr map = cornerMap();
+    Eigen::Isometry3d truth = testPose(0.3, -0.2, 0.1, 0.05);
+    std::unique_ptr<PointToPlaneRegistration> plain = cornerRegistration(map, 0);
+    std::unique_ptr<PointToPlaneRegistration> reuse = cornerRegistration(map, 0.1);
+
+    RunResult without = alignCorner(*plain, map, truth);
+    RunResult with = alignCorner(*reuse, map, truth);
+    EXPECT_LT(with.error, 1e-3);
+    EXPECT_LT(with.searches, without.searches * 3 / 4);
+
+    // the next frame, seeded with the last pose, starts from the correspondences of this one
+    Eigen::Isometry3d next = testPose(0.35, -0.2, 0.1, 0.05);
+    RunResult second = alignCorner(*reuse, map, next, truth);
+    EXPECT_LT(second.error, 1e-3);
+    EXPECT_LT(second.searches, with.searches);
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include "registration_pyramid.h"
+#include "synthetic_scene.h"
+
+namespace
+{
+
+typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+Cloud::Ptr cornerCloud()
+{
+    return Cloud::Ptr(new Cloud(scanOf(*cornerMap(), Eigen::Isometry3d::Identity(), 1)));
+}
+
+} // namespace
+
+TEST(RegistrationPyramid, LevelStoppedByTheIterationCapDoesNotSeed)
+{
+    Cloud::Ptr map = cornerCloud();
+    Eigen::Isometry3d truth = testPose(1.0, -0.5, 0, 0.1);
+    Cloud::Ptr scan(new Cloud(scanOf(*cornerMap(), truth, 3)));
+
+    // a single iteration on 8 m voxels from a guess 1.5 m off cannot settle, PCL still reports it converged
+    RegistrationPyramid<pcl::PointXYZI> pyramid;
+    pyramid.build(map, {8.0f}, 3.0, 1);
+    Eigen::Matrix4f start = testPose(2.2, 0.4, 0, 0.25).matrix().cast<float>();
+    Eigen::Matrix4f guess = start;
+    EXPECT_EQ(pyramid.align(scan, guess), 1);
+    EXPECT_TRUE(guess.isApprox(start));
+}
+
+TEST(RegistrationPyramid, ConvergedLevelsRefineTheGuess)
+{
+    Cloud::Ptr map = cornerCloud();
+    Eigen::Isometry3d truth = testPose(1.0, -0.5, 0, 0.1);
+    Cloud::Ptr scan(new Cloud(scanOf(*cornerMap(), truth, 3)));
+
+    RegistrationPyramid<pcl::PointXYZI> pyramid;
+    pyramid.build(map, {1.0f, 0.5f}, 3.0, 50);
+    Eigen::Matrix4f guess = testPose(1.3, -0.3, 0, 0.13).matrix().cast<float>();
+    double initial_error = poseError(guess, truth);
+    pyramid.align(scan, guess);
+    EXPECT_LT(poseError(guess, truth), 0.5 * initial_error);
+}
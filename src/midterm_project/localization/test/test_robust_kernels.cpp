@@ -0,0 +1,74 @@
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "point_to_plane.h"
+#include "synthetic_scene.h"
+
+namespace
+{
+
+/**
+ * @brief corner scan with a share of its points moved off the planes, inside the correspondence gate
+ *
+ */
+pcl::PointCloud<pcl::PointXYZI> scanWithOutliers(const NormalMap &map, const Eigen::Isometry3d &truth, double outlier_ratio)
+{
+    pcl::PointCloud<pcl::PointXYZI> scan = scanOf(map, truth, 7);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> chance(0, 1), offset(-0.6f, 0.6f);
+    for (pcl::PointXYZI &p : scan.points)
+    {
+        if (chance(rng) >= outlier_ratio)
+            continue;
+        p.x += offset(rng);
+        p.y += offset(rng);
+        p.z += offset(rng);
+    }
+    return scan;
+}
+
+double alignWithKernel(GaussNewtonRegistration::Kernel kernel, const NormalMap::Ptr &map,
+                       const pcl::PointCloud<pcl::PointXYZI> &scan, const Eigen::Isometry3d &truth)
+{
+    PointToPlaneRegistration registration;
+    registration.setMaximumIterations(50);
+    registration.setMaxCorrespondenceDistance(1.0);
+    registration.setInputTarget(map);
+    registration.setRobustKernel(kernel);
+    registration.align(scan, Eigen::Matrix4f::Identity());
+    return poseError(registration.getFinalTransformation(), truth);
+}
+
+} // namespace
+
+TEST(RobustKernels, ParseNames)
+{
+    GaussNewtonRegistration::Kernel kernel;
+    ASSERT_TRUE(GaussNewtonRegistration::parseKernel("cauchy", kernel));
+    EXPECT_EQ(kernel, GaussNewtonRegistration::CAUCHY);
+    EXPECT_FALSE(GaussNewtonRegistration::parseKernel("tukey", kernel));
+}
+
+TEST(RobustKernels, RejectPerturbedPoints)
+{
+    NormalMap::Ptr map = cornerMap();
+    Eigen::Isometry3d truth = testPose(0.3, -0.2, 0.1, 0.05);
+    pcl::PointCloud<pcl::PointXYZI> scan = scanWithOutliers(*map, truth, 0.4);
+
+    double plain = alignWithKernel(GaussNewtonRegistration::NONE, map, scan, truth);
+    EXPECT_GT(plain, 1e-2);
+    for (GaussNewtonRegistration::Kernel kernel :
+         {GaussNewtonRegistration::HUBER, GaussNewtonRegistration::CAUCHY, GaussNewtonRegistration::GEMAN_MCCLURE})
+    {
+        double robust = alignWithKernel(kernel, map, scan, truth);
+        EXPECT_LT(robust, 1e-3) << "kernel " << kernel;
+        EXPECT_LT(robust, plain / 10) << "kernel " << kernel;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}